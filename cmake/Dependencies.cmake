@@ -14,6 +14,11 @@ list(APPEND Caffe_LINKER_LIBS PUBLIC ${Boost_LIBRARIES})
 find_package(Threads REQUIRED)
 list(APPEND Caffe_LINKER_LIBS PRIVATE ${CMAKE_THREAD_LIBS_INIT})
 
+# ---[ shm_open for boost::interprocess shared memory on older glibc
+if(UNIX AND NOT APPLE)
+  list(APPEND Caffe_LINKER_LIBS PRIVATE rt)
+endif()
+
 # ---[ OpenMP
 if(USE_OPENMP)
   # Ideally, this should be provided by the BLAS library IMPORTED target. However,
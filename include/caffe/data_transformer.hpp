@@ -38,6 +38,22 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation defined in the data layer's
+   * transform_param block to a non-encoded Datum whose uint8 pixels are
+   * held outside of it, e.g. in a memory-mapped database.
+   *
+   * @param datum
+   *    Datum giving the shape of the data; see ParseDatumHeader.
+   * @param data
+   *    The pixels, laid out as in Datum::data.
+   * @param transformed_blob
+   *    This is destination blob. It can be part of top blob's data if
+   *    set_cpu_data() is used. See data_layer.cpp for an example.
+   */
+  void Transform(const Datum& datum, const char* data,
+                 Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -128,6 +144,17 @@ class DataTransformer {
   vector<int> InferBlobShape(const cv::Mat& cv_img);
 #endif  // USE_OPENCV
 
+  /**
+   * @brief Decodes an encoded Datum into a Datum of uint8 pixels, in the
+   *    colors Transform would decode it in.
+   *
+   * @param datum
+   *    Datum containing an encoded image.
+   * @param decoded
+   *    Datum receiving the pixels, shape and label.
+   */
+  void Decode(const Datum& datum, Datum* decoded);
+
  protected:
    /**
    * @brief Generates a random integer from Uniform({0, 1, ..., n-1}).
@@ -140,6 +167,13 @@ class DataTransformer {
   virtual int Rand(int n);
 
   void Transform(const Datum& datum, Dtype* transformed_data);
+  // Reads uint8 pixels from data, or datum.float_data() if data is NULL.
+  void Transform(const Datum& datum, const char* data,
+                 Dtype* transformed_data);
+#ifdef USE_OPENCV
+  // Decodes an encoded datum following force_color and force_gray.
+  cv::Mat DecodeToCVMat(const Datum& datum);
+#endif  // USE_OPENCV
   // Tranformation parameters
   TransformationParameter param_;
 
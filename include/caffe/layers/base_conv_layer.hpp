@@ -94,6 +94,10 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool force_nd_im2col_;
 
  private:
+  // backward_cpu_gemm for the 2D case, computing col_buffer_ a block of
+  // input channels at a time and folding each block into the input.
+  void backward_cpu_gemm_blocked(const Dtype* output, const Dtype* weights,
+      Dtype* input);
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
   inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
@@ -164,6 +168,8 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int kernel_dim_;
   int col_offset_;
   int output_offset_;
+  /// @brief Input channels per block in backward_cpu_gemm; 0 if unblocked.
+  int col2im_tile_channels_;
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
@@ -69,6 +69,25 @@ class BasePrefetchingDataLayer :
  protected:
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
+  // Transforms items [begin, end) of a batch whose inputs the subclass has
+  // staged in load_batch, using worker_transformer(worker_id). Called
+  // concurrently on disjoint ranges by TransformBatchItems, so it must only
+  // write to those items and to state owned by the worker.
+  virtual void transform_items(Batch<Dtype>* batch, int worker_id, int begin,
+      int end);
+  // Splits items [0, item_count) into num_workers_ contiguous ranges and
+  // runs transform_items on them in parallel, the first on the calling
+  // thread. Worker i always gets the same range and its own transformer,
+  // so results are deterministic for a given seed and worker count.
+  // Called from load_batch on the prefetch thread.
+  void TransformBatchItems(Batch<Dtype>* batch, int item_count);
+  // Loop of workers 1..num_workers_-1, which the prefetch thread starts
+  // once and stops on its way out.
+  void TransformWorkerEntry(int worker_id);
+  DataTransformer<Dtype>* worker_transformer(int worker_id) {
+    return worker_id == 0 ? this->data_transformer_.get() :
+        worker_transformers_[worker_id - 1].get();
+  }
 
   vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
@@ -76,6 +95,16 @@ class BasePrefetchingDataLayer :
   Batch<Dtype>* prefetch_current_;
 
   Blob<Dtype> transformed_data_;
+
+  int num_workers_;
+  // Transformers of workers 1..num_workers_-1; worker 0 uses
+  // data_transformer_.
+  vector<shared_ptr<DataTransformer<Dtype> > > worker_transformers_;
+  // Batches handed to workers 1..num_workers_-1 with the item count of the
+  // batch, and the workers done with their range.
+  vector<shared_ptr<BlockingQueue<Batch<Dtype>*> > > worker_batches_;
+  int worker_item_count_;
+  BlockingQueue<int> workers_done_;
 };
 
 }  // namespace caffe
@@ -60,6 +60,8 @@ class BatchNormLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // On the CPU, temp_ is never touched and x_norm_ only holds data when the
+  // layer runs in place, so neither is allocated otherwise.
   Blob<Dtype> mean_, variance_, temp_, x_norm_;
   bool use_global_stats_;
   Dtype moving_average_fraction_;
@@ -67,7 +69,7 @@ class BatchNormLayer : public Layer<Dtype> {
   Dtype eps_;
 
   // extra temporarary variables is used to carry out sums/broadcasting
-  // using BLAS
+  // using BLAS (GPU path only)
   Blob<Dtype> batch_sum_multiplier_;
   Blob<Dtype> num_by_chans_;
   Blob<Dtype> spatial_sum_multiplier_;
@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_LAYER_HPP_
 #define CAFFE_DATA_LAYER_HPP_
 
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -9,6 +10,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/datum_cache.hpp"
 #include "caffe/util/db.hpp"
 
 namespace caffe {
@@ -29,10 +31,75 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   void Next();
   bool Skip();
   virtual void load_batch(Batch<Dtype>* batch);
+  virtual void transform_items(Batch<Dtype>* batch, int worker_id, int begin,
+      int end);
+
+  // A contiguous range of records read by a single worker in sharded mode.
+  struct Shard {
+    shared_ptr<db::Cursor> cursor;
+    string first_key;
+    size_t size;
+    size_t position;
+  };
+  void SetUpShards();
+  // Indexes the keys read by this rank and shuffles them for the first epoch.
+  void SetUpShuffle();
+  void ShuffleKeys();
+  // Views the next record of this rank's sequence and advances past it.
+  // Its key is copied into *key unless key is NULL. Records the cache holds
+  // are not read, and get a NULL *value.
+  void ReadValue(string* key, string* copy, const char** value,
+      size_t* value_size);
+  // Stages the next record as item item_id of the batch, drawing it from the
+  // shuffle buffer if there is one.
+  void ReadItem(int item_id);
+  // Advances within the shard, wrapping around to its first record.
+  void NextInShard(Shard* shard);
+  // Points *value at the cursor's current value, copying it into *copy only
+  // if the backend offers no stable view.
+  static void ViewValue(db::Cursor* cursor, string* copy, const char** value,
+      size_t* value_size);
+  // Decodes a serialized record into datum. Raw uint8 pixels are left in
+  // the record and returned; NULL means datum was parsed in full.
+  static const char* ParseValue(const char* value, size_t value_size,
+      Datum* datum);
+  // Returns the uint8 pixels of the record under key and sets the shape and
+  // label of datum. value is only read for records missing from the cache,
+  // which are parsed from it, decoded into datum if encoded, and cached.
+  // Returns NULL for records of float data, which are left in datum
+  // uncached.
+  const char* CachedPixels(const string& key, const char* value,
+      size_t value_size, DataTransformer<Dtype>* transformer, Datum* datum);
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
   uint64_t offset_;
+  // One per worker in sharded mode, empty otherwise.
+  vector<Shard> shards_;
+  // Serialized records of the batch being loaded. value_data_ points into
+  // the database when the cursor offers views, otherwise into values_.
+  vector<const char*> value_data_;
+  vector<size_t> value_size_;
+  vector<string> values_;
+  // Keys of the staged records, only kept when caching.
+  vector<string> value_keys_;
+  shared_ptr<DatumCache> cache_;
+
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // Keys of this rank's records in the order of the current epoch, and the
+  // position of the record under cursor_ in it. Empty unless shuffling.
+  vector<string> keys_;
+  size_t key_position_;
+  // A slot of the shuffle buffer, holding a record like the staged ones.
+  struct BufferedValue {
+    string key;
+    string copy;
+    const char* data;
+    size_t size;
+  };
+  vector<BufferedValue> shuffle_buffer_;
+  // Number of slots already filled; the buffer fills on first use.
+  size_t buffer_filled_;
 };
 
 }  // namespace caffe
@@ -68,7 +68,10 @@ class DropoutLayer : public NeuronLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
   /// when divided by UINT_MAX, the randomly generated values @f$u\sim U(0,1)@f$
+  /// (GPU only)
   Blob<unsigned int> rand_vec_;
+  /// seed of the counter-based RNG that generated the last CPU mask
+  uint64_t mask_seed_;
   /// the probability @f$ p @f$ of dropping any input
   Dtype threshold_;
   /// the scale for undropped inputs at train time @f$ 1 / (1 - p) @f$
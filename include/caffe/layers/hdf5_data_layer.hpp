@@ -7,23 +7,36 @@
 #include <vector>
 
 #include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 
 #include "caffe/layers/base_data_layer.hpp"
 
 namespace caffe {
 
+/// Consecutive rows of every dataset of an HDF5 file.
+template <typename Dtype>
+class HDF5Chunk {
+ public:
+  vector<shared_ptr<Blob<Dtype> > > blobs_;
+};
+
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
+ * Files are read in chunks of chunk_size rows, the next one by a background
+ * thread while the current one is served, so memory use is bounded by two
+ * chunks rather than by file size.
+ *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public Layer<Dtype>, public InternalThread {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param), offset_() {}
+      : Layer<Dtype>(param), file_id_(-1), chunk_(), offset_() {}
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -38,6 +51,12 @@ class HDF5DataLayer : public Layer<Dtype> {
  protected:
   void Next();
   bool Skip();
+  // Reads the next chunk_size rows of the current file into chunk, moving
+  // on to the next file at its end.
+  void ReadChunk(HDF5Chunk<Dtype>* chunk);
+  // Resets data_permutation_ to the rows of chunk_, shuffled if needed.
+  void PermuteRows();
+  virtual void InternalThreadEntry();
 
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -47,15 +66,26 @@ class HDF5DataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
+  // The file being read, its number of rows and the next row to read.
   unsigned int current_file_;
+  hid_t file_id_;
+  hsize_t file_rows_;
+  hsize_t file_row_;
+  // The chunk being served and the row of it to serve next.
+  HDF5Chunk<Dtype>* chunk_;
   hsize_t current_row_;
-  std::vector<shared_ptr<Blob<Dtype> > > hdf_blobs_;
+  // A single file read into one chunk stays in it.
+  bool resident_;
+  vector<shared_ptr<HDF5Chunk<Dtype> > > chunks_;
+  BlockingQueue<HDF5Chunk<Dtype>*> chunk_free_;
+  BlockingQueue<HDF5Chunk<Dtype>*> chunk_full_;
   std::vector<unsigned int> data_permutation_;
   std::vector<unsigned int> file_permutation_;
+  // Reshuffles file_permutation_, possibly on the reader thread.
+  shared_ptr<Caffe::RNG> file_rng_;
   uint64_t offset_;
 };
 
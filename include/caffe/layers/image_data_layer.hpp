@@ -36,9 +36,16 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  // Returns the line at lines_id_ and advances it, reshuffling the lines at
+  // the end of every epoch.
+  void NextLine(std::pair<std::string, int>* line);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+
+  // Threads decoding the next images of lines_, when decode_threads is set.
+  class DecodePool;
+  shared_ptr<DecodePool> decode_pool_;
 };
 
 
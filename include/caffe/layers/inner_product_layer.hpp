@@ -39,6 +39,9 @@ class InnerProductLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  /// Masks rows [m0, m0 + rows) of the input into dropout_block_.
+  const Dtype* MaskBlock(const Dtype* bottom_data, const int m0,
+      const int rows);
 
   int M_;
   int K_;
@@ -46,6 +49,15 @@ class InnerProductLayer : public Layer<Dtype> {
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
   bool transpose_;  ///< if true, assume transposed weights
+
+  /// fused input dropout (see InnerProductParameter.input_dropout_ratio)
+  Dtype dropout_ratio_;
+  unsigned int dropout_threshold_;
+  Dtype dropout_scale_;
+  uint64_t dropout_seed_;
+  /// masked rows of the input, a block at a time
+  Blob<Dtype> dropout_block_;
+  int dropout_block_rows_;
 };
 
 }  // namespace caffe
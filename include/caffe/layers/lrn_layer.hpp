@@ -67,8 +67,12 @@ class LRNLayer : public Layer<Dtype> {
   int width_;
 
   // Fields used for normalization ACROSS_CHANNELS
-  // scale_ stores the intermediate summing results
+  // scale_ stores the intermediate summing results; the CPU path leaves it
+  // unallocated and recomputes it per tile when recompute_scale_ is set.
   Blob<Dtype> scale_;
+  bool recompute_scale_;
+  // Spatial tile width of the cache-blocked CPU path.
+  int tile_size_;
 
   // Fields used for normalization WITHIN_CHANNEL
   shared_ptr<SplitLayer<Dtype> > split_layer_;
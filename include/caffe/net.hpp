@@ -2,6 +2,7 @@
 #ifndef CAFFE_NET_HPP_
 #define CAFFE_NET_HPP_
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -113,8 +114,13 @@ class Net {
    */
   void CopyTrainedLayersFrom(const NetParameter& param);
   void CopyTrainedLayersFrom(const string& trained_filename);
+  /// @brief Copies the values of the layers of other into the own storage
+  ///        of this net, unlike ShareTrainedLayersWith.
+  void CopyTrainedLayersFrom(const Net* other);
   void CopyTrainedLayersFromBinaryProto(const string& trained_filename);
   void CopyTrainedLayersFromHDF5(const string& trained_filename);
+  /// @brief Copies the pre-trained layers from a mapped weights file.
+  void CopyTrainedLayersFromWeightsFile(const string& trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
   /// @brief Writes the net to an HDF5 file.
@@ -192,6 +198,15 @@ class Net {
     return param_names_index_;
   }
   inline const vector<int>& param_owners() const { return param_owners_; }
+  /// @brief returns the (layer, blob) indices of each of params()
+  inline const vector<pair<int, int> >& param_layer_indices() const {
+    return param_layer_indices_;
+  }
+  /// @brief returns the index in learnable_params() of each of params(),
+  ///        or of its owner
+  inline const vector<int>& learnable_param_ids() const {
+    return learnable_param_ids_;
+  }
   inline const vector<string>& param_display_names() const {
     return param_display_names_;
   }
@@ -252,6 +267,10 @@ class Net {
   void add_after_backward(Callback* value) {
     after_backward_.push_back(value);
   }
+  void remove_after_backward(Callback* value) {
+    after_backward_.erase(std::remove(after_backward_.begin(),
+        after_backward_.end(), value), after_backward_.end());
+  }
 
  protected:
   // Helpers for Init.
@@ -2,8 +2,7 @@
 #ifndef CAFFE_PARALLEL_HPP_
 #define CAFFE_PARALLEL_HPP_
 
-#ifdef USE_NCCL
-
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/thread.hpp>
 
 #include <string>
@@ -17,7 +16,9 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#ifdef USE_NCCL
 #include "caffe/util/nccl.hpp"
+#endif
 
 namespace caffe {
 
@@ -49,6 +50,145 @@ class Params {
 DISABLE_COPY_AND_ASSIGN(Params);
 };
 
+/**
+ * Groups the gradients of consecutive layers into buckets of at least
+ * bucket_size bytes, for the data-parallel solvers to reduce each one as
+ * soon as backward is done with it. Buckets index into a buffer that holds
+ * the learnable params of the net back to back, as laid out by Params, and
+ * come in the order backward completes them.
+ */
+template<typename Dtype>
+class ReduceBuckets {
+ public:
+  ReduceBuckets(const Net<Dtype>& net, size_t bucket_size);
+
+  inline int size() const {
+    return begin_.size();
+  }
+  /// The bucket completed by the backward pass of layer, or -1.
+  inline int ready(int layer) const {
+    return ready_[layer];
+  }
+  inline size_t begin(int bucket) const {
+    return begin_[bucket];
+  }
+  inline size_t end(int bucket) const {
+    return end_[bucket];
+  }
+
+ protected:
+  vector<int> ready_;
+  vector<size_t> begin_;
+  vector<size_t> end_;
+
+DISABLE_COPY_AND_ASSIGN(ReduceBuckets);
+};
+
+/**
+ * Data-parallel training of solvers on the CPU of one host, each in its own
+ * process (or thread), with gradients averaged through shared memory.
+ *
+ * Every worker maps the same shared segment, which holds one gradient
+ * buffer per worker. The learnable params of each solver get their diffs
+ * from the buffer of their worker, so backward writes straight to shared
+ * memory. Once gradients are ready, worker r sums chunk r of all buffers
+ * and copies the average back to each of them (a reduce-scatter followed by
+ * an allgather), so every worker reads and writes about one gradient per
+ * iteration whatever their number. Weights stay private to each worker and
+ * remain identical as all of them apply the same updates.
+ *
+ * With layer_wise_reduce, a thread of each worker reduces the buckets of
+ * ReduceBuckets while backward goes on with the layers below them.
+ *
+ * With gradient_compression_error, each worker instead quantizes its
+ * gradients of a bucket, as snapshots are, into a shared area of its own,
+ * and every worker decodes and averages those of all workers. The error of
+ * quantization is kept and added to the next gradients of the worker.
+ */
+template<typename Dtype>
+class SharedMemoryAllReduce : public Params<Dtype>,
+                              public Solver<Dtype>::Callback,
+                              public Net<Dtype>::Callback,
+                              public InternalThread {
+ public:
+  /**
+   * Single process version: creates a segment for Caffe::solver_count()
+   * workers, to be started by Run.
+   */
+  explicit SharedMemoryAllReduce(shared_ptr<Solver<Dtype> > solver);
+  /**
+   * In multi-process settings, every worker joins the segment of the given
+   * name, which the first one to get there creates. Workers are told apart
+   * by Caffe::solver_rank().
+   */
+  SharedMemoryAllReduce(shared_ptr<Solver<Dtype> > solver,
+                        const string& shared_name);
+  ~SharedMemoryAllReduce();
+
+  /**
+   * Waits for all workers to join, then broadcasts weights from rank 0 to
+   * the other solvers.
+   */
+  void Broadcast();
+
+  /**
+   * Single process: runs the solver and Caffe::solver_count() - 1 more on
+   * as many threads.
+   */
+  void Run(const char* restore);
+
+  const string& shared_name() const { return shared_name_; }
+
+ protected:
+  struct Header;
+
+  void Init();
+  // Waits until all workers have called Barrier.
+  void Barrier();
+  Dtype* buffer(int rank) const;
+  char* codes(int rank, int bucket) const;
+  // Averages elements [begin, end) over all buffers, once every worker is
+  // done writing them.
+  void Reduce(size_t begin, size_t end);
+  void ReduceCompressed(int bucket);
+  void ReduceBucket(int bucket);
+  void on_start() {}
+  void run(int layer);  // Net callback
+  void on_gradients_ready();
+  void InternalThreadEntry();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  string shared_name_;
+  int rank_;
+  int worker_count_;
+  boost::interprocess::mapped_region region_;
+  Header* header_;
+  shared_ptr<ReduceBuckets<Dtype> > buckets_;
+  // Buckets to reduce, and the last one once it is.
+  BlockingQueue<int> ready_;
+  BlockingQueue<int> done_;
+  double compression_error_;
+  // Offset of the codes of each bucket in the area of a worker, and the
+  // size of that area last.
+  vector<size_t> codes_offsets_;
+  // What quantization left out of the gradients sent so far.
+  vector<Dtype> residual_;
+  vector<Dtype> decoded_;
+  QuantizedData quantized_;
+  // Bytes of gradients sent, compressed and not, over the iterations
+  // since last displayed.
+  size_t exchanged_bytes_;
+  size_t full_bytes_;
+  int exchanges_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+
+DISABLE_COPY_AND_ASSIGN(SharedMemoryAllReduce);
+};
+
+#ifdef USE_NCCL
+
 // Params stored in GPU memory.
 template<typename Dtype>
 class GPUParams : public Params<Dtype> {
@@ -111,6 +251,7 @@ class NCCL : public GPUParams<Dtype>,
   cudaStream_t stream_;
 
   shared_ptr<Solver<Dtype> > solver_;
+  shared_ptr<ReduceBuckets<Dtype> > buckets_;
   // Should not be necessary, https://github.com/NVIDIA/nccl/issues/37
   boost::barrier* barrier_;
   using Params<Dtype>::size_;
@@ -118,7 +259,8 @@ class NCCL : public GPUParams<Dtype>,
   using Params<Dtype>::diff_;
 };
 
+#endif  // USE_NCCL
+
 }  // namespace caffe
 
-#endif  // USE_NCCL
 #endif  // header
\ No newline at end of file
@@ -3,6 +3,7 @@
 #define CAFFE_SGD_SOLVERS_HPP_
 
 #include <string>
+#include <typeinfo>
 #include <vector>
 
 #include "caffe/solver.hpp"
@@ -26,12 +27,43 @@ class SGDSolver : public Solver<Dtype> {
 
   virtual void ApplyUpdate();
   Dtype GetLearningRate();
+  // The number of iterations whose params were updated during the backward
+  // pass, as eager_update asks for.
+  int eager_updates() const;
 
  protected:
   void PreSolve();
   virtual void Normalize(int param_id);
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  /**
+   * @brief Updates elements [begin, end) of param param_id in a single pass
+   *        on the CPU, doing the work of Normalize, Regularize,
+   *        ComputeUpdateValue and Net::Update, and leaves the update in the
+   *        param diff as they do.
+   *
+   * Called concurrently on disjoint ranges, and only if has_fused_update().
+   */
+  virtual void ComputeFusedUpdate(int param_id, Dtype rate, int begin,
+      int end);
+  /**
+   * @brief Whether ApplyUpdate may call ComputeFusedUpdate instead of
+   *        Normalize, Regularize and ComputeUpdateValue on the CPU.
+   *
+   * Each solver implementing ComputeFusedUpdate opts in for its own class
+   * only, so that a subclass overriding any of those keeps them called
+   * until it opts in too.
+   */
+  virtual inline bool has_fused_update() const {
+    return typeid(*this) == typeid(SGDSolver<Dtype>);
+  }
+  // Runs ComputeFusedUpdate on blocks of the given params in parallel.
+  void ApplyFusedUpdate(Dtype rate, const vector<int>& param_ids);
+  // The scale of Normalize and the decays of Regularize for param_id, which
+  // turn a diff g of weight w into diff_scale * g + l2_decay * w +
+  // l1_decay * sign(w).
+  void GetRegularization(int param_id, Dtype* diff_scale, Dtype* l2_decay,
+      Dtype* l1_decay);
   virtual void ClipGradients();
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
@@ -43,6 +75,10 @@ class SGDSolver : public Solver<Dtype> {
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // Updates the params of each layer during the backward pass when
+  // eager_update is set. Declared last, so that its thread stops first.
+  class EagerUpdater;
+  shared_ptr<EagerUpdater> eager_updater_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -58,6 +94,11 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeFusedUpdate(int param_id, Dtype rate, int begin,
+      int end);
+  virtual inline bool has_fused_update() const {
+    return typeid(*this) == typeid(NesterovSolver<Dtype>);
+  }
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -73,6 +114,11 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeFusedUpdate(int param_id, Dtype rate, int begin,
+      int end);
+  virtual inline bool has_fused_update() const {
+    return typeid(*this) == typeid(AdaGradSolver<Dtype>);
+  }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -93,6 +139,11 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeFusedUpdate(int param_id, Dtype rate, int begin,
+      int end);
+  virtual inline bool has_fused_update() const {
+    return typeid(*this) == typeid(RMSPropSolver<Dtype>);
+  }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -117,6 +168,11 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeFusedUpdate(int param_id, Dtype rate, int begin,
+      int end);
+  virtual inline bool has_fused_update() const {
+    return typeid(*this) == typeid(AdaDeltaSolver<Dtype>);
+  }
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -141,6 +197,11 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeFusedUpdate(int param_id, Dtype rate, int begin,
+      int end);
+  virtual inline bool has_fused_update() const {
+    return typeid(*this) == typeid(AdamSolver<Dtype>);
+  }
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
@@ -1,6 +1,8 @@
 
 #ifndef CAFFE_SOLVER_HPP_
 #define CAFFE_SOLVER_HPP_
+#include <stdint.h>
+
 #include <boost/function.hpp>
 #include <string>
 #include <vector>
@@ -8,6 +10,7 @@
 #include "caffe/net.hpp"
 #include "caffe/solver_factory.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/snapshot_writer.hpp"
 
 namespace caffe {
 
@@ -102,9 +105,19 @@ class Solver {
   string SnapshotFilename(const string& extension);
   string SnapshotToBinaryProto();
   string SnapshotToHDF5();
+  // Writes to net_param the layers that changed since the last full
+  // snapshot, or all of them when model_filename is to be the new base.
+  void SnapshotDeltaToProto(const string& model_filename,
+      NetParameter* net_param);
+  // Writes proto to filename, on snapshot_writer_ with snapshot_async.
+  void WriteSnapshotProto(const shared_ptr<google::protobuf::Message>& proto,
+      const string& filename);
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
+  // Runs the test iterations of a test net on its current weights and logs
+  // the results. In the background, requested actions are left to Step.
+  void TestNet(const int test_net_id, const bool background);
   virtual void SnapshotSolverState(const string& model_filename) = 0;
   virtual void RestoreSolverStateFromHDF5(const string& state_file) = 0;
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file) = 0;
@@ -131,6 +144,16 @@ class Solver {
   Timer iteration_timer_;
   float iterations_last_;
 
+  shared_ptr<SnapshotWriter> snapshot_writer_;
+  // With snapshot_delta, the last full weights snapshot and a hash of the
+  // blobs of every layer as it recorded them.
+  string snapshot_base_;
+  vector<uint64_t> snapshot_base_hashes_;
+
+  // With test_async, tests copies of the weights while training goes on.
+  class TestThread;
+  shared_ptr<TestThread> test_thread_;
+
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
 
@@ -0,0 +1,60 @@
+#ifndef CAFFE_UTIL_DATUM_CACHE_HPP_
+#define CAFFE_UTIL_DATUM_CACHE_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A fixed-size cache of decoded uint8 samples, keyed by their
+ *        database key.
+ *
+ * Samples are only ever added, until the cache is full, so the pixels
+ * returned by Find() stay valid for the lifetime of the cache. The cache is
+ * either private to the process or lives in a named shared-memory segment,
+ * which every process on the host opening the same name reads and fills.
+ * A shared segment outlives the processes using it, and has to be removed
+ * (e.g. from /dev/shm) when its source or decoding settings change. Find()
+ * takes no lock, and on Linux a process killed in Insert() does not block
+ * the others.
+ */
+class DatumCache {
+ public:
+  /// An empty shared_name makes a cache private to the process.
+  DatumCache(size_t capacity, const string& shared_name);
+  ~DatumCache();
+
+  /**
+   * Returns the pixels of the sample cached under key and sets the shape
+   * and label of datum, or returns NULL if key is not cached.
+   */
+  const char* Find(const string& key, Datum* datum) const;
+  /// Whether key is cached, so that its record need not be read.
+  bool Contains(const string& key) const;
+  /**
+   * Caches channels x height x width uint8 pixels with the shape and label
+   * of datum under key, unless the cache is full or already holds key.
+   * Returns whether the sample was added.
+   */
+  bool Insert(const string& key, const Datum& datum, const char* pixels);
+
+  /// Number of samples cached.
+  size_t size() const;
+  /// Bytes of samples cached, out of capacity().
+  size_t bytes() const;
+  size_t capacity() const;
+
+ protected:
+  // Keeps boost::interprocess out of this header.
+  class Segment;
+  shared_ptr<Segment> segment_;
+
+  DISABLE_COPY_AND_ASSIGN(DatumCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DATUM_CACHE_HPP_
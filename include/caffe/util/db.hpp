@@ -16,9 +16,22 @@ class Cursor {
   Cursor() { }
   virtual ~Cursor() { }
   virtual void SeekToFirst() = 0;
+  // Positions the cursor at the first record whose key is not less than key.
+  virtual void Seek(const string& key) = 0;
+  // Positions the cursor at the record with the given index. The default
+  // walks the keys from the first record.
+  virtual void SeekToOffset(size_t offset);
+  // Returns the number of records and leaves the cursor at the first one.
+  // The default walks every key.
+  virtual size_t count();
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // Points *data at the current value without copying it. Only backends
+  // whose values stay valid after the cursor moves on, for as long as the
+  // cursor lives, provide this; the others return false and value() must
+  // be used instead.
+  virtual bool value_view(const char** data, size_t* size) { return false; }
   virtual bool valid() = 0;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
@@ -26,6 +26,17 @@ class LMDBCursor : public Cursor {
     mdb_txn_abort(mdb_txn_);
   }
   virtual void SeekToFirst() { Seek(MDB_FIRST); }
+  virtual void Seek(const string& key) {
+    mdb_key_.mv_size = key.size();
+    mdb_key_.mv_data = const_cast<char*>(key.data());
+    Seek(MDB_SET_RANGE);
+  }
+  virtual size_t count() {
+    MDB_stat stat;
+    MDB_CHECK(mdb_stat(mdb_txn_, mdb_cursor_dbi(mdb_cursor_), &stat));
+    SeekToFirst();
+    return stat.ms_entries;
+  }
   virtual void Next() { Seek(MDB_NEXT); }
   virtual string key() {
     return string(static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size);
@@ -34,6 +45,13 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  // The read-only transaction pins the memory-mapped pages until the cursor
+  // is destroyed, so views of them remain valid after Next().
+  virtual bool value_view(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+    return true;
+  }
   virtual bool valid() { return valid_; }
 
  private:
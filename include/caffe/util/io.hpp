@@ -91,6 +91,18 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+// Writes proto to a temporary file next to filename, syncs it to disk and
+// renames it over filename, so that filename is never seen half written.
+void WriteProtoToBinaryFileAtomically(const Message& proto,
+    const string& filename);
+
+// Decodes a serialized, non-encoded uint8 Datum without copying its pixels:
+// header receives every field but data, and *data points at the pixel bytes
+// inside buffer. Returns false for encoded or float Datums, which must be
+// parsed in full.
+bool ParseDatumHeader(const char* buffer, size_t size, Datum* header,
+    const char** data, size_t* data_size);
+
 bool ReadFileToDatum(const string& filename, const int label, Datum* datum);
 
 inline bool ReadFileToDatum(const string& filename, Datum* datum) {
@@ -142,6 +154,18 @@ cv::Mat ReadImageToCVMat(const string& filename,
 
 cv::Mat ReadImageToCVMat(const string& filename);
 
+/**
+ * @brief Like ReadImageToCVMat(filename, height, width, is_color), but lets
+ *        the JPEG decoder scale the image down by 2, 4 or 8 as long as it
+ *        stays at least height x width, before resizing it.
+ *
+ * Much faster than a full decode for images several times larger than the
+ * target size, though the pixels differ slightly from it. Falls back to a
+ * full decode for other formats and before OpenCV 3.2.
+ */
+cv::Mat ReadImageToCVMatReduced(const string& filename,
+    const int height, const int width, const bool is_color);
+
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
 
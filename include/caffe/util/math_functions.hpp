@@ -20,6 +20,14 @@ void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// Same as above, but with explicit leading dimensions so that A, B and C may
+// be sub-blocks of larger row-major matrices.
+template <typename Dtype>
+void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int lda, const Dtype* B,
+    const int ldb, const Dtype beta, Dtype* C, const int ldc);
+
 template <typename Dtype>
 void caffe_cpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -88,6 +96,16 @@ void caffe_rng_bernoulli(const int n, const Dtype p, int* r);
 template <typename Dtype>
 void caffe_rng_bernoulli(const int n, const Dtype p, unsigned int* r);
 
+// Counter-based dropout: y[i] = x[i] * scale if the Philox draw for element i
+// under seed exceeds threshold, and 0 otherwise. The mask is a pure function
+// of (seed, i), so Backward can regenerate it instead of storing it.
+// x and y may alias. Elements are numbered from first, so that a range of a
+// larger array can be masked on its own.
+template <typename Dtype>
+void caffe_cpu_dropout(const int n, const unsigned int threshold,
+    const Dtype scale, const uint64_t seed, const Dtype* x, Dtype* y,
+    const int first = 0);
+
 template <typename Dtype>
 void caffe_exp(const int n, const Dtype* a, Dtype* y);
 
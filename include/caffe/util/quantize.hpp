@@ -0,0 +1,42 @@
+#ifndef CAFFE_UTIL_QUANTIZE_HPP_
+#define CAFFE_UTIL_QUANTIZE_HPP_
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Replaces the data or double_data of proto with quantized_data,
+ *        every value within error times the largest magnitude of the data
+ *        of its original.
+ *
+ * The proto is left as it is if its data is empty or not finite, or would
+ * not get smaller. The diff is never touched.
+ */
+void QuantizeBlobProto(double error, BlobProto* proto);
+
+/**
+ * @brief Quantizes the count values of data into quantized, every value
+ *        within error times their largest magnitude.
+ *
+ * Returns false, leaving quantized as it is, if data is not finite or would
+ * not get smaller.
+ */
+template <typename Dtype>
+bool QuantizeData(const Dtype* data, int count, double error,
+    QuantizedData* quantized);
+
+/// @brief Decodes the count values of quantized into data.
+template <typename Dtype>
+void DequantizeData(const QuantizedData& quantized, int count, Dtype* data);
+
+/// @brief Decodes count values from the codes and step of quantized data
+///        held elsewhere than in a QuantizedData.
+template <typename Dtype>
+void DequantizeCodes(const char* codes, size_t size, double step, int count,
+    Dtype* data);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZE_HPP_
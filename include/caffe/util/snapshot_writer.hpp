@@ -0,0 +1,50 @@
+#ifndef CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+#define CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+
+#include <google/protobuf/message.h>
+
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Writes snapshot files on an internal thread, so that training does
+ *        not wait for serialization and disk I/O.
+ *
+ * Files are written in the order they are queued, each with
+ * WriteProtoToBinaryFileAtomically, so that a snapshot file on disk is
+ * always complete.
+ */
+class SnapshotWriter : public InternalThread {
+ public:
+  SnapshotWriter();
+  virtual ~SnapshotWriter();
+
+  /// Queues proto to be written to filename. proto must not change anymore.
+  void Write(const shared_ptr<google::protobuf::Message>& proto,
+      const string& filename);
+  /// Blocks until every queued file is written.
+  void Wait();
+
+  struct File {
+    shared_ptr<google::protobuf::Message> proto;
+    string filename;
+  };
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  BlockingQueue<File*> queued_;
+  BlockingQueue<File*> written_;
+  int pending_;
+
+  DISABLE_COPY_AND_ASSIGN(SnapshotWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
@@ -0,0 +1,68 @@
+#ifndef CAFFE_UTIL_WEIGHTS_FILE_H_
+#define CAFFE_UTIL_WEIGHTS_FILE_H_
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A container for the learned parameters of a net that loads by
+ *        mapping the file rather than parsing it.
+ *
+ * The file starts with a fixed header (magic, element size, index size) in
+ * host byte order, followed by the index: a NetParameter holding the layer
+ * names and blob shapes of the source net but none of its values. The
+ * values of every blob then follow as raw arrays in index order, each one
+ * starting on a kAlignment byte boundary.
+ */
+class WeightsFile {
+ public:
+  static const size_t kAlignment = 64;
+
+  /// Maps filename read-only; dies if it is not a weights file.
+  explicit WeightsFile(const string& filename);
+
+  /// Whether filename starts with the weights file magic.
+  static bool IsWeightsFile(const string& filename);
+
+  /// The layers and blob shapes of the source net, without values.
+  const NetParameter& index() const { return index_; }
+
+  /**
+   * @brief Copies the values of blob blob_id of index layer layer_id into
+   *        blob, which must already have the shape recorded in the index.
+   */
+  template <typename Dtype>
+  void CopyBlob(int layer_id, int blob_id, Blob<Dtype>* blob) const;
+
+ private:
+  string filename_;
+  boost::interprocess::file_mapping file_;
+  boost::interprocess::mapped_region region_;
+  NetParameter index_;
+  size_t element_size_;
+  // Offset of the values of every blob, by layer then blob.
+  vector<vector<size_t> > offsets_;
+  vector<vector<size_t> > counts_;
+
+  DISABLE_COPY_AND_ASSIGN(WeightsFile);
+};
+
+/**
+ * @brief Writes the blobs of param, as read from a caffemodel, to filename
+ *        as a weights file. Values are stored as float unless a blob holds
+ *        double_data.
+ */
+void WriteWeightsFile(const NetParameter& param, const string& filename);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WEIGHTS_FILE_H_
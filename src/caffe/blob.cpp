@@ -5,6 +5,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantize.hpp"
 
 namespace caffe {
 
@@ -487,7 +488,9 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   }
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  if (proto.double_data_size() > 0) {
+  if (proto.has_quantized_data()) {
+    DequantizeData(proto.quantized_data(), count_, data_vec);
+  } else if (proto.double_data_size() > 0) {
     CHECK_EQ(count_, proto.double_data_size());
     for (int i = 0; i < count_; ++i) {
       data_vec[i] = proto.double_data(i);
@@ -521,15 +524,13 @@ void Blob<double>::ToProto(BlobProto* proto, bool write_diff) const {
   }
   proto->clear_double_data();
   proto->clear_double_diff();
-  const double* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_double_data(data_vec[i]);
-  }
+  proto->clear_quantized_data();
+  proto->mutable_double_data()->Resize(count_, 0);
+  caffe_copy(count_, cpu_data(), proto->mutable_double_data()->mutable_data());
   if (write_diff) {
-    const double* diff_vec = cpu_diff();
-    for (int i = 0; i < count_; ++i) {
-      proto->add_double_diff(diff_vec[i]);
-    }
+    proto->mutable_double_diff()->Resize(count_, 0);
+    caffe_copy(count_, cpu_diff(),
+        proto->mutable_double_diff()->mutable_data());
   }
 }
 
@@ -541,15 +542,12 @@ void Blob<float>::ToProto(BlobProto* proto, bool write_diff) const {
   }
   proto->clear_data();
   proto->clear_diff();
-  const float* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_data(data_vec[i]);
-  }
+  proto->clear_quantized_data();
+  proto->mutable_data()->Resize(count_, 0);
+  caffe_copy(count_, cpu_data(), proto->mutable_data()->mutable_data());
   if (write_diff) {
-    const float* diff_vec = cpu_diff();
-    for (int i = 0; i < count_; ++i) {
-      proto->add_diff(diff_vec[i]);
-    }
+    proto->mutable_diff()->Resize(count_, 0);
+    caffe_copy(count_, cpu_diff(), proto->mutable_diff()->mutable_data());
   }
 }
 
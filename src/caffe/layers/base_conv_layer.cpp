@@ -9,6 +9,14 @@
 
 namespace caffe {
 
+namespace {
+
+// Target size of one block of col_buffer_ rows in the blocked backward-data
+// pass, chosen to stay resident in a typical per-core L2 cache.
+const int kCol2imTileBytes = 256 * 1024;
+
+}  // namespace
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -241,6 +249,16 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     }
   }
   col_buffer_.Reshape(col_buffer_shape_);
+  // The backward-data pass produces and folds col_buffer_ a few input
+  // channels at a time so the block stays in cache between the GEMM and the
+  // col2im scatter. Only the 2D col2im path supports sub-blocks.
+  col2im_tile_channels_ = 0;
+  if (!is_1x1_ && !force_nd_im2col_ && num_spatial_axes_ == 2) {
+    const int channel_bytes = kernel_shape_.cpu_data()[0] *
+        kernel_shape_.cpu_data()[1] * conv_out_spatial_dim_ * sizeof(Dtype);
+    col2im_tile_channels_ = std::min(conv_in_channels_ / group_,
+        std::max(1, kCol2imTileBytes / channel_bytes));
+  }
   bottom_dim_ = bottom[0]->count(channel_axis_);
   top_dim_ = top[0]->count(channel_axis_);
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
@@ -285,6 +303,10 @@ template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
   Dtype* col_buff = col_buffer_.mutable_cpu_data();
+  if (col2im_tile_channels_ > 0) {
+    backward_cpu_gemm_blocked(output, weights, input);
+    return;
+  }
   if (is_1x1_) {
     col_buff = input;
   }
@@ -299,6 +321,38 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_blocked(
+    const Dtype* output, const Dtype* weights, Dtype* input) {
+  // Rows [c * kernel_area, (c + tile) * kernel_area) of a group's
+  // col_buffer_ gradient depend only on the matching columns of the weights
+  // and scatter only into input channels [c, c + tile), so each block is
+  // computed into the head of col_buffer_ and folded into the input at once.
+  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+  const int* kernel_shape = kernel_shape_.cpu_data();
+  const int* input_shape = conv_input_shape_.cpu_data();
+  const int kernel_area = kernel_shape[0] * kernel_shape[1];
+  const int input_channel_size = input_shape[1] * input_shape[2];
+  const int in_channels_per_group = conv_in_channels_ / group_;
+  for (int g = 0; g < group_; ++g) {
+    for (int c = 0; c < in_channels_per_group; c += col2im_tile_channels_) {
+      const int channels =
+          std::min(col2im_tile_channels_, in_channels_per_group - c);
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, channels * kernel_area,
+          conv_out_spatial_dim_, conv_out_channels_ / group_, (Dtype)1.,
+          weights + weight_offset_ * g + c * kernel_area, kernel_dim_,
+          output + output_offset_ * g, conv_out_spatial_dim_,
+          (Dtype)0., col_buff, conv_out_spatial_dim_);
+      col2im_cpu(col_buff, channels, input_shape[1], input_shape[2],
+          kernel_shape[0], kernel_shape[1],
+          pad_.cpu_data()[0], pad_.cpu_data()[1],
+          stride_.cpu_data()[0], stride_.cpu_data()[1],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1],
+          input + (g * in_channels_per_group + c) * input_channel_size);
+    }
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
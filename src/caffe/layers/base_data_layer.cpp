@@ -1,4 +1,5 @@
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <vector>
 
@@ -38,7 +39,10 @@ BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
     const LayerParameter& param)
     : BaseDataLayer<Dtype>(param),
       prefetch_(param.data_param().prefetch()),
-      prefetch_free_(), prefetch_full_(), prefetch_current_() {
+      prefetch_free_(), prefetch_full_(), prefetch_current_(),
+      num_workers_(param.data_param().num_workers()),
+      worker_item_count_() {
+  CHECK_GE(num_workers_, 1) << "num_workers must be positive.";
   for (int i = 0; i < prefetch_.size(); ++i) {
     prefetch_[i].reset(new Batch<Dtype>());
     prefetch_free_.push(prefetch_[i].get());
@@ -72,6 +76,15 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
 #endif
   DLOG(INFO) << "Initializing prefetch";
   this->data_transformer_->InitRand();
+  worker_transformers_.clear();
+  worker_batches_.clear();
+  for (int i = 1; i < num_workers_; ++i) {
+    worker_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    worker_transformers_.back()->InitRand();
+    worker_batches_.push_back(shared_ptr<BlockingQueue<Batch<Dtype>*> >(
+        new BlockingQueue<Batch<Dtype>*>()));
+  }
   StartInternalThread();
   DLOG(INFO) << "Prefetch initialized.";
 }
@@ -84,6 +97,11 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
     CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
   }
 #endif
+  boost::thread_group workers;
+  for (int i = 1; i < num_workers_; ++i) {
+    workers.create_thread(boost::bind(
+        &BasePrefetchingDataLayer<Dtype>::TransformWorkerEntry, this, i));
+  }
 
   try {
     while (!must_stop()) {
@@ -103,6 +121,9 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+  // The workers are idle, waiting for the next batch.
+  workers.interrupt_all();
+  workers.join_all();
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
     CUDA_CHECK(cudaStreamDestroy(stream));
@@ -110,6 +131,49 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::TransformWorkerEntry(int worker_id) {
+  try {
+    while (true) {
+      Batch<Dtype>* batch = worker_batches_[worker_id - 1]->pop();
+      const int item_count = worker_item_count_;
+      transform_items(batch, worker_id,
+          item_count * worker_id / num_workers_,
+          item_count * (worker_id + 1) / num_workers_);
+      workers_done_.push(worker_id);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::transform_items(Batch<Dtype>* batch,
+    int worker_id, int begin, int end) {
+  LOG(FATAL) << this->type() << " does not support parallel transformation.";
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::TransformBatchItems(Batch<Dtype>* batch,
+    int item_count) {
+  if (num_workers_ == 1) {
+    transform_items(batch, 0, 0, item_count);
+    return;
+  }
+  // Workers write into the batch, so the prefetch thread must not be torn
+  // down before they are done with it.
+  boost::this_thread::disable_interruption no_interruption;
+  // Pushing the batch publishes the count to the workers.
+  worker_item_count_ = item_count;
+  for (int i = 1; i < num_workers_; ++i) {
+    worker_batches_[i - 1]->push(batch);
+  }
+  transform_items(batch, 0, 0, item_count / num_workers_);
+  for (int i = 1; i < num_workers_; ++i) {
+    workers_done_.pop();
+  }
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
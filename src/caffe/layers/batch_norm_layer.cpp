@@ -89,51 +89,51 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  int num = bottom[0]->shape(0);
-  int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
-
-  if (bottom[0] != top[0]) {
-    caffe_copy(bottom[0]->count(), bottom_data, top_data);
-  }
+  const int num = bottom[0]->shape(0);
+  const int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
+  const int channels = channels_;
+  Dtype* mean = mean_.mutable_cpu_data();
+  Dtype* variance = variance_.mutable_cpu_data();
 
   if (use_global_stats_) {
     // use the stored mean/variance estimates.
     const Dtype scale_factor = this->blobs_[2]->cpu_data()[0] == 0 ?
         0 : 1 / this->blobs_[2]->cpu_data()[0];
     caffe_cpu_scale(variance_.count(), scale_factor,
-        this->blobs_[0]->cpu_data(), mean_.mutable_cpu_data());
+        this->blobs_[0]->cpu_data(), mean);
     caffe_cpu_scale(variance_.count(), scale_factor,
-        this->blobs_[1]->cpu_data(), variance_.mutable_cpu_data());
+        this->blobs_[1]->cpu_data(), variance);
   } else {
-    // compute mean
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), bottom_data,
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-        num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-        mean_.mutable_cpu_data());
-  }
-
-  // subtract mean
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, -1, num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., top_data);
-
-  if (!use_global_stats_) {
-    // compute variance using var(X) = E((X-EX)^2)
-    caffe_sqr<Dtype>(top[0]->count(), top_data,
-                     temp_.mutable_cpu_data());  // (X-EX)^2
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), temp_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-        num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-        variance_.mutable_cpu_data());  // E((X_EX)^2)
+    // Single pass over the input per channel: the mean and the sum of
+    // squared deviations of each (n, c) row are computed while the row is
+    // in cache, and rows are merged with the pairwise update of Chan et al.
+    // (the batched form of Welford's algorithm).
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+    for (int c = 0; c < channels; ++c) {
+      Dtype count = 0, channel_mean = 0, channel_m2 = 0;
+      for (int n = 0; n < num; ++n) {
+        const Dtype* x = bottom_data + (n * channels + c) * spatial_dim;
+        Dtype row_sum = 0;
+        for (int i = 0; i < spatial_dim; ++i) {
+          row_sum += x[i];
+        }
+        const Dtype row_mean = row_sum / spatial_dim;
+        Dtype row_m2 = 0;
+        for (int i = 0; i < spatial_dim; ++i) {
+          const Dtype d = x[i] - row_mean;
+          row_m2 += d * d;
+        }
+        const Dtype delta = row_mean - channel_mean;
+        const Dtype merged = count + spatial_dim;
+        channel_mean += delta * spatial_dim / merged;
+        channel_m2 += row_m2 + delta * delta * count * spatial_dim / merged;
+        count = merged;
+      }
+      mean[c] = channel_mean;
+      variance[c] = channel_m2 / count;  // E((X_EX)^2)
+    }
 
     // compute and save moving average
     this->blobs_[2]->mutable_cpu_data()[0] *= moving_average_fraction_;
@@ -148,43 +148,64 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   }
 
   // normalize variance
-  caffe_add_scalar(variance_.count(), eps_, variance_.mutable_cpu_data());
-  caffe_sqrt(variance_.count(), variance_.cpu_data(),
-             variance_.mutable_cpu_data());
-
-  // replicate variance to input size
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), variance_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., temp_.mutable_cpu_data());
-  caffe_div(temp_.count(), top_data, temp_.cpu_data(), top_data);
-  // TODO(cdoersch): The caching is only needed because later in-place layers
-  //                 might clobber the data.  Can we skip this if they won't?
-  caffe_copy(x_norm_.count(), top_data,
-      x_norm_.mutable_cpu_data());
+  caffe_add_scalar(variance_.count(), eps_, variance);
+  caffe_sqrt(variance_.count(), variance, variance);
+
+  // Subtract the mean and divide by the standard deviation in one sweep;
+  // works in place since every element is read before it is written.
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int c = 0; c < channels; ++c) {
+    const Dtype channel_mean = mean[c];
+    const Dtype inv_std = Dtype(1) / variance[c];
+    for (int n = 0; n < num; ++n) {
+      const int offset = (n * channels + c) * spatial_dim;
+      const Dtype* x = bottom_data + offset;
+      Dtype* y = top_data + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        y[i] = (x[i] - channel_mean) * inv_std;
+      }
+    }
+  }
+  // The normalized output is only cached when running in place: later
+  // in-place layers may clobber it, and the input it was computed from is
+  // gone. Otherwise Backward_cpu recomputes it from the bottom data, which
+  // is left untouched.
+  if (bottom[0] == top[0]) {
+    caffe_copy(x_norm_.count(), top_data, x_norm_.mutable_cpu_data());
+  }
 }
 
 template <typename Dtype>
 void BatchNormLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* top_diff;
-  if (bottom[0] != top[0]) {
-    top_diff = top[0]->cpu_diff();
-  } else {
-    caffe_copy(x_norm_.count(), top[0]->cpu_diff(), x_norm_.mutable_cpu_diff());
-    top_diff = x_norm_.cpu_diff();
-  }
+  // top_diff and bottom_diff may alias: each element of dE/dY is read
+  // before the matching element of dE/dX is written.
+  const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const int num = bottom[0]->shape()[0];
+  const int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
+  const int channels = channels_;
+  // variance_ still contains sqrt(var(X)+eps), computed during the forward
+  // pass.
+  const Dtype* std_dev = variance_.cpu_data();
   if (use_global_stats_) {
-    caffe_div(temp_.count(), top_diff, temp_.cpu_data(), bottom_diff);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+    for (int c = 0; c < channels; ++c) {
+      const Dtype inv_std = Dtype(1) / std_dev[c];
+      for (int n = 0; n < num; ++n) {
+        const int offset = (n * channels + c) * spatial_dim;
+        for (int i = 0; i < spatial_dim; ++i) {
+          bottom_diff[offset + i] = top_diff[offset + i] * inv_std;
+        }
+      }
+    }
     return;
   }
-  const Dtype* top_data = x_norm_.cpu_data();
-  int num = bottom[0]->shape()[0];
-  int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
   // if Y = (X-mean(X))/(sqrt(var(X)+eps)), then
   //
   // dE(Y)/dX =
@@ -196,50 +217,44 @@ void BatchNormLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   // along all dimensions except the channels dimension.  In the above
   // equation, the operations allow for expansion (i.e. broadcast) along all
   // dimensions except the channels dimension where required.
-
-  // sum(dE/dY \cdot Y)
-  caffe_mul(temp_.count(), top_data, top_diff, bottom_diff);
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      bottom_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-      num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-      mean_.mutable_cpu_data());
-
-  // reshape (broadcast) the above
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., bottom_diff);
-
-  // sum(dE/dY \cdot Y) \cdot Y
-  caffe_mul(temp_.count(), top_data, bottom_diff, bottom_diff);
-
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      top_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-      num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-      mean_.mutable_cpu_data());
-  // reshape (broadcast) the above to make
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num * channels_,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., bottom_diff);
-
-  // dE/dY - mean(dE/dY)-mean(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_axpby(temp_.count(), Dtype(1), top_diff,
-      Dtype(-1. / (num * spatial_dim)), bottom_diff);
-
-  // note: temp_ still contains sqrt(var(X)+eps), computed during the forward
-  // pass.
-  caffe_div(temp_.count(), bottom_diff, temp_.cpu_data(), bottom_diff);
+  //
+  // Y is read back from x_norm_ when the layer ran in place and recomputed
+  // from X otherwise.
+  const bool in_place = bottom[0] == top[0];
+  const Dtype* x_data = in_place ? x_norm_.cpu_data() : bottom[0]->cpu_data();
+  const Dtype* mean = mean_.cpu_data();
+  const Dtype inv_m = Dtype(1) / (num * spatial_dim);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int c = 0; c < channels; ++c) {
+    const Dtype inv_std = Dtype(1) / std_dev[c];
+    const Dtype shift = in_place ? Dtype(0) : mean[c];
+    const Dtype y_scale = in_place ? Dtype(1) : inv_std;
+    // sum(dE/dY) and sum(dE/dY \cdot Y)
+    Dtype sum_dy = 0, sum_dy_y = 0;
+    for (int n = 0; n < num; ++n) {
+      const int offset = (n * channels + c) * spatial_dim;
+      const Dtype* x = x_data + offset;
+      const Dtype* dy = top_diff + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum_dy += dy[i];
+        sum_dy_y += dy[i] * (x[i] - shift) * y_scale;
+      }
+    }
+    const Dtype mean_dy = sum_dy * inv_m;
+    const Dtype mean_dy_y = sum_dy_y * inv_m;
+    for (int n = 0; n < num; ++n) {
+      const int offset = (n * channels + c) * spatial_dim;
+      const Dtype* x = x_data + offset;
+      const Dtype* dy = top_diff + offset;
+      Dtype* dx = bottom_diff + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        const Dtype y = (x[i] - shift) * y_scale;
+        dx[i] = (dy[i] - mean_dy - mean_dy_y * y) * inv_std;
+      }
+    }
+  }
 }
 
 
@@ -9,13 +9,15 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
 DataLayer<Dtype>::DataLayer(const LayerParameter& param)
   : BasePrefetchingDataLayer<Dtype>(param),
-    offset_() {
+    offset_(), key_position_(), buffer_filled_() {
   db_.reset(db::GetDB(param.data_param().backend()));
   db_->Open(param.data_param().source(), db::READ);
   cursor_.reset(db_->NewCursor());
@@ -55,10 +57,93 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       this->prefetch_[i]->label_.Reshape(label_shape);
     }
   }
+  const DataParameter& data_param = this->layer_param_.data_param();
+  if (data_param.sharded()) {
+    SetUpShards();
+  }
+  if (data_param.shuffle() || data_param.shuffle_buffer() > 0) {
+    CHECK(!data_param.sharded())
+        << "Shuffling is not supported with sharded reading.";
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  }
+  if (data_param.shuffle()) {
+    SetUpShuffle();
+  }
+  shuffle_buffer_.resize(data_param.shuffle_buffer());
+  if (data_param.cache_size_mb() > 0) {
+    cache_.reset(new DatumCache(
+        static_cast<size_t>(data_param.cache_size_mb()) << 20,
+        data_param.cache_name()));
+    LOG_IF(INFO, Caffe::root_solver())
+        << "Caching up to " << data_param.cache_size_mb()
+        << " MB of decoded samples";
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::SetUpShards() {
+  // In test mode, only rank 0 runs, so it reads the whole database.
+  const bool test = this->layer_param_.phase() == TEST;
+  const int ranks = test ? 1 : Caffe::solver_count();
+  const int rank = test ? 0 : Caffe::solver_rank();
+  const int workers = this->num_workers_;
+  const size_t shard_count = static_cast<size_t>(ranks) * workers;
+  const size_t records = cursor_->count();
+  CHECK_GE(records, shard_count)
+      << "Too few records to give every rank and worker its own shard.";
+  shards_.resize(workers);
+  for (int i = 0; i < workers; ++i) {
+    const size_t shard = static_cast<size_t>(rank) * workers + i;
+    const size_t begin = records * shard / shard_count;
+    const size_t end = records * (shard + 1) / shard_count;
+    shards_[i].cursor.reset(db_->NewCursor());
+    shards_[i].cursor->SeekToOffset(begin);
+    shards_[i].first_key = shards_[i].cursor->key();
+    shards_[i].size = end - begin;
+    shards_[i].position = 0;
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Reading " << records << " records in " << shard_count
+      << " shards";
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::SetUpShuffle() {
+  // Index the same records that Skip() would keep for this rank.
+  const bool test = this->layer_param_.phase() == TEST;
+  const int size = test ? 1 : Caffe::solver_count();
+  const int rank = test ? 0 : Caffe::solver_rank();
+  size_t key_bytes = 0;
+  size_t index = 0;
+  for (cursor_->SeekToFirst(); cursor_->valid(); cursor_->Next(), ++index) {
+    if (index % size == rank) {
+      keys_.push_back(cursor_->key());
+      key_bytes += keys_.back().size();
+    }
+  }
+  CHECK(!keys_.empty()) << "No records left to shuffle for this rank.";
+  ShuffleKeys();
+  cursor_->Seek(keys_[key_position_]);
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Shuffling " << keys_.size() << " records every epoch, "
+      << "indexed by " << key_bytes << " bytes of keys";
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::ShuffleKeys() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(keys_.begin(), keys_.end(), prefetch_rng);
+  key_position_ = 0;
 }
 
 template <typename Dtype>
 bool DataLayer<Dtype>::Skip() {
+  // The shuffled keys only include the records of this rank.
+  if (!keys_.empty()) {
+    return false;
+  }
   int size = Caffe::solver_count();
   int rank = Caffe::solver_rank();
   bool keep = (offset_ % size) == rank ||
@@ -67,17 +152,84 @@ bool DataLayer<Dtype>::Skip() {
   return !keep;
 }
 
+template<typename Dtype>
+void DataLayer<Dtype>::NextInShard(Shard* shard) {
+  if (++shard->position == shard->size) {
+    shard->cursor->Seek(shard->first_key);
+    shard->position = 0;
+  } else {
+    shard->cursor->Next();
+  }
+}
+
 template<typename Dtype>
 void DataLayer<Dtype>::Next() {
-  cursor_->Next();
-  if (!cursor_->valid()) {
-    LOG_IF(INFO, Caffe::root_solver())
-        << "Restarting data prefetching from start.";
-    cursor_->SeekToFirst();
+  if (!keys_.empty()) {
+    if (++key_position_ == keys_.size()) {
+      LOG_IF(INFO, Caffe::root_solver())
+          << "Restarting data prefetching in a new order.";
+      ShuffleKeys();
+    }
+    cursor_->Seek(keys_[key_position_]);
+  } else {
+    cursor_->Next();
+    if (!cursor_->valid()) {
+      LOG_IF(INFO, Caffe::root_solver())
+          << "Restarting data prefetching from start.";
+      cursor_->SeekToFirst();
+    }
   }
   offset_++;
 }
 
+template<typename Dtype>
+void DataLayer<Dtype>::ReadValue(string* key, string* copy,
+    const char** value, size_t* value_size) {
+  while (Skip()) {
+    Next();
+  }
+  if (key) {
+    *key = cursor_->key();
+  }
+  if (cache_ && cache_->Contains(*key)) {
+    // Cached records are not read from the database.
+    *value = NULL;
+    *value_size = 0;
+  } else {
+    ViewValue(cursor_.get(), copy, value, value_size);
+  }
+  Next();
+}
+
+template<typename Dtype>
+void DataLayer<Dtype>::ReadItem(int item_id) {
+  if (shuffle_buffer_.empty()) {
+    ReadValue(cache_ ? &value_keys_[item_id] : NULL, &values_[item_id],
+        &value_data_[item_id], &value_size_[item_id]);
+    return;
+  }
+  for (; buffer_filled_ < shuffle_buffer_.size(); ++buffer_filled_) {
+    BufferedValue& slot = shuffle_buffer_[buffer_filled_];
+    ReadValue(cache_ ? &slot.key : NULL, &slot.copy, &slot.data,
+        &slot.size);
+  }
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  BufferedValue& slot =
+      shuffle_buffer_[(*prefetch_rng)() % shuffle_buffer_.size()];
+  // Hand the record over to the batch without copying it, then refill the
+  // slot. A copied record has to be re-pointed, as short strings keep their
+  // characters inline.
+  const bool copied = slot.data == slot.copy.data();
+  values_[item_id].swap(slot.copy);
+  value_data_[item_id] = copied ? values_[item_id].data() : slot.data;
+  value_size_[item_id] = slot.size;
+  if (cache_) {
+    value_keys_[item_id].swap(slot.key);
+  }
+  ReadValue(cache_ ? &slot.key : NULL, &slot.copy, &slot.data, &slot.size);
+}
+
 // This function is called on prefetch thread
 template<typename Dtype>
 void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
@@ -91,39 +243,55 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   const int batch_size = this->layer_param_.data_param().batch_size();
 
   Datum datum;
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
-    while (Skip()) {
-      Next();
+  timer.Start();
+  if (shards_.empty()) {
+    // The cursor is sequential, so the raw records of the whole batch are
+    // staged here and parsed and transformed by the workers. Backends that
+    // can hand out stable views of their values are not copied from.
+    values_.resize(batch_size);
+    value_data_.resize(batch_size);
+    value_size_.resize(batch_size);
+    if (cache_) {
+      value_keys_.resize(batch_size);
     }
-    datum.ParseFromString(cursor_->value());
-    read_time += timer.MicroSeconds();
-
-    if (item_id == 0) {
-      // Reshape according to the first datum of each batch
-      // on single input batches allows for inputs of varying dimension.
-      // Use data_transformer to infer the expected blob shape from datum.
-      vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
-      this->transformed_data_.Reshape(top_shape);
-      // Reshape batch according to the batch_size.
-      top_shape[0] = batch_size;
-      batch->data_.Reshape(top_shape);
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      ReadItem(item_id);
     }
-
-    // Apply data transformations (mirror, scale, crop...)
-    timer.Start();
-    int offset = batch->data_.offset(item_id);
-    Dtype* top_data = batch->data_.mutable_cpu_data();
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      Dtype* top_label = batch->label_.mutable_cpu_data();
-      top_label[item_id] = datum.label();
+    if (!cache_ || !cache_->Find(value_keys_[0], &datum)) {
+      ParseValue(value_data_[0], value_size_[0], &datum);
     }
-    trans_time += timer.MicroSeconds();
-    Next();
+  } else {
+    // Every worker reads its own shard in transform_items, so reading is
+    // counted as transform time; here only the first record is peeked at.
+    const char* value;
+    size_t value_size;
+    string copy;
+    db::Cursor* cursor = shards_[0].cursor.get();
+    if (!cache_ || !cache_->Find(cursor->key(), &datum)) {
+      ViewValue(cursor, &copy, &value, &value_size);
+      ParseValue(value, value_size, &datum);
+    }
+  }
+  read_time += timer.MicroSeconds();
+
+  // Reshape according to the first datum of each batch
+  // on single input batches allows for inputs of varying dimension.
+  // Use data_transformer to infer the expected blob shape from datum.
+  vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
+  this->transformed_data_.Reshape(top_shape);
+  // Reshape batch according to the batch_size.
+  top_shape[0] = batch_size;
+  batch->data_.Reshape(top_shape);
+  // Take ownership of the CPU copies before the workers write into them.
+  batch->data_.mutable_cpu_data();
+  if (this->output_labels_) {
+    batch->label_.mutable_cpu_data();
   }
+
+  // Apply data transformations (mirror, scale, crop...)
+  timer.Start();
+  this->TransformBatchItems(batch, batch_size);
+  trans_time += timer.MicroSeconds();
   timer.Stop();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
@@ -131,6 +299,102 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template<typename Dtype>
+void DataLayer<Dtype>::transform_items(Batch<Dtype>* batch, int worker_id,
+    int begin, int end) {
+  DataTransformer<Dtype>* transformer = this->worker_transformer(worker_id);
+  Shard* shard = shards_.empty() ? NULL : &shards_[worker_id];
+  string key;
+  string copy;
+  Datum datum;
+  Blob<Dtype> transformed_data(this->transformed_data_.shape());
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = this->output_labels_ ?
+      batch->label_.mutable_cpu_data() : NULL;
+  for (int item_id = begin; item_id < end; ++item_id) {
+    const char* value = NULL;
+    size_t value_size = 0;
+    if (shard) {
+      if (cache_) {
+        key = shard->cursor->key();
+      }
+      // Cached records are not read from the database.
+      if (!cache_ || !cache_->Contains(key)) {
+        ViewValue(shard->cursor.get(), &copy, &value, &value_size);
+      }
+    } else {
+      value = value_data_[item_id];
+      value_size = value_size_[item_id];
+    }
+    const char* pixels;
+    if (cache_) {
+      pixels = CachedPixels(shard ? key : value_keys_[item_id], value,
+          value_size, transformer, &datum);
+    } else {
+      pixels = ParseValue(value, value_size, &datum);
+    }
+    int offset = batch->data_.offset(item_id);
+    transformed_data.set_cpu_data(top_data + offset);
+    if (pixels) {
+      transformer->Transform(datum, pixels, &transformed_data);
+    } else {
+      transformer->Transform(datum, &transformed_data);
+    }
+    // Copy label.
+    if (top_label) {
+      top_label[item_id] = datum.label();
+    }
+    if (shard) {
+      NextInShard(shard);
+    }
+  }
+}
+
+template<typename Dtype>
+void DataLayer<Dtype>::ViewValue(db::Cursor* cursor, string* copy,
+    const char** value, size_t* value_size) {
+  if (!cursor->value_view(value, value_size)) {
+    *copy = cursor->value();
+    *value = copy->data();
+    *value_size = copy->size();
+  }
+}
+
+template<typename Dtype>
+const char* DataLayer<Dtype>::ParseValue(const char* value, size_t value_size,
+    Datum* datum) {
+  const char* pixels;
+  size_t pixel_count;
+  if (ParseDatumHeader(value, value_size, datum, &pixels, &pixel_count)) {
+    CHECK_EQ(pixel_count, static_cast<size_t>(datum->channels()) *
+        datum->height() * datum->width()) << "Malformed datum.";
+    return pixels;
+  }
+  CHECK(datum->ParseFromArray(value, value_size));
+  return NULL;
+}
+
+template<typename Dtype>
+const char* DataLayer<Dtype>::CachedPixels(const string& key,
+    const char* value, size_t value_size, DataTransformer<Dtype>* transformer,
+    Datum* datum) {
+  const char* pixels = cache_->Find(key, datum);
+  if (pixels) {
+    return pixels;
+  }
+  pixels = ParseValue(value, value_size, datum);
+  if (!pixels && datum->encoded()) {
+    Datum decoded;
+    transformer->Decode(*datum, &decoded);
+    datum->Swap(&decoded);
+    pixels = datum->data().data();
+  }
+  if (pixels) {
+    cache_->Insert(key, *datum, pixels);
+  }
+  return pixels;
+}
+
 INSTANTIATE_CLASS(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
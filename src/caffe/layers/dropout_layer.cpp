@@ -22,7 +22,8 @@ template <typename Dtype>
 void DropoutLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   NeuronLayer<Dtype>::Reshape(bottom, top);
-  // Set up the cache for random number generation
+  // Set up the cache for random number generation on GPU; the CPU path never
+  // touches it, so it is not allocated there.
   // ReshapeLike does not work because rand_vec_ is of Dtype uint
   rand_vec_.Reshape(bottom[0]->shape());
 }
@@ -32,14 +33,13 @@ void DropoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  unsigned int* mask = rand_vec_.mutable_cpu_data();
   const int count = bottom[0]->count();
   if (this->phase_ == TRAIN) {
-    // Create random numbers
-    caffe_rng_bernoulli(count, 1. - threshold_, mask);
-    for (int i = 0; i < count; ++i) {
-      top_data[i] = bottom_data[i] * mask[i] * scale_;
-    }
+    // Draw a fresh seed; the mask itself is never materialized on CPU.
+    mask_seed_ = (static_cast<uint64_t>(caffe_rng_rand()) << 32)
+        | caffe_rng_rand();
+    caffe_cpu_dropout(count, uint_thres_, scale_, mask_seed_, bottom_data,
+        top_data);
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
   }
@@ -53,11 +53,9 @@ void DropoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     if (this->phase_ == TRAIN) {
-      const unsigned int* mask = rand_vec_.cpu_data();
-      const int count = bottom[0]->count();
-      for (int i = 0; i < count; ++i) {
-        bottom_diff[i] = top_diff[i] * mask[i] * scale_;
-      }
+      // Regenerate the forward mask from its seed.
+      caffe_cpu_dropout(bottom[0]->count(), uint_thres_, scale_, mask_seed_,
+          top_diff, bottom_diff);
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
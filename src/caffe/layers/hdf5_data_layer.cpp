@@ -1,13 +1,13 @@
-
 #ifdef USE_HDF5
 /*
 TODO:
-- load file in a separate thread ("prefetch")
 - can be smarter about the memcpy call instead of doing it row-by-row
   :: use util functions caffe_copy, and Blob->offset()
   :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
 */
+#include <boost/thread.hpp>
+
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -18,56 +18,99 @@ TODO:
 
 #include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
-
-// Load data and label from HDF5 filename into the class property blobs.
-template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  DLOG(INFO) << "Loading HDF5 file: " << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
-    LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  this->StopInternalThread();
+  if (file_id_ >= 0) {
+    H5Fclose(file_id_);
   }
+}
 
-  int top_size = this->layer_param_.top_size();
-  hdf_blobs_.resize(top_size);
-
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::ReadChunk(HDF5Chunk<Dtype>* chunk) {
+  const int top_size = this->layer_param_.top_size();
   const int MIN_DATA_DIM = 1;
   const int MAX_DATA_DIM = INT_MAX;
-
+  if (file_id_ < 0) {
+    const string& filename = hdf_filenames_[file_permutation_[current_file_]];
+    DLOG(INFO) << "Loading HDF5 file: " << filename;
+    file_id_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id_ < 0) {
+      LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+    }
+    // MinTopBlobs==1 guarantees at least one top blob
+    file_rows_ = hdf5_get_dataset_shape(file_id_,
+        this->layer_param_.top(0).c_str(), MIN_DATA_DIM, MAX_DATA_DIM)[0];
+    for (int i = 1; i < top_size; ++i) {
+      CHECK_EQ(hdf5_get_dataset_shape(file_id_,
+          this->layer_param_.top(i).c_str(), MIN_DATA_DIM, MAX_DATA_DIM)[0],
+          file_rows_);
+    }
+    CHECK_GT(file_rows_, 0) << "Empty HDF5 file: " << filename;
+    file_row_ = 0;
+  }
+  const hsize_t chunk_size =
+      this->layer_param_.hdf5_data_param().chunk_size();
+  const hsize_t rows = chunk_size == 0 ? file_rows_ :
+      std::min(chunk_size, file_rows_ - file_row_);
+  chunk->blobs_.resize(top_size);
   for (int i = 0; i < top_size; ++i) {
-    hdf_blobs_[i] = shared_ptr<Blob<Dtype> >(new Blob<Dtype>());
-    // Allow reshape here, as we are loading data not params
-    hdf5_load_nd_dataset(file_id, this->layer_param_.top(i).c_str(),
-        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs_[i].get(), true);
+    if (!chunk->blobs_[i]) {
+      chunk->blobs_[i].reset(new Blob<Dtype>());
+    }
+    hdf5_load_nd_dataset_rows(file_id_, this->layer_param_.top(i).c_str(),
+        MIN_DATA_DIM, MAX_DATA_DIM, file_row_, rows, chunk->blobs_[i].get());
   }
-
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
-
-  // MinTopBlobs==1 guarantees at least one top blob
-  CHECK_GE(hdf_blobs_[0]->num_axes(), 1) << "Input must have at least 1 axis.";
-  const int num = hdf_blobs_[0]->shape(0);
-  for (int i = 1; i < top_size; ++i) {
-    CHECK_EQ(hdf_blobs_[i]->shape(0), num);
+  DLOG(INFO) << "Successfully loaded rows " << file_row_ << " to "
+      << file_row_ + rows << " of " << file_rows_;
+  file_row_ += rows;
+  if (file_row_ == file_rows_) {
+    herr_t status = H5Fclose(file_id_);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file: "
+        << hdf_filenames_[file_permutation_[current_file_]];
+    file_id_ = -1;
+    if (++current_file_ == num_files_) {
+      current_file_ = 0;
+      if (this->layer_param_.hdf5_data_param().shuffle()) {
+        // This may run on the reader thread, so it draws from its own
+        // generator rather than from the serving thread's.
+        caffe::rng_t* file_rng =
+            static_cast<caffe::rng_t*>(file_rng_->generator());
+        shuffle(file_permutation_.begin(), file_permutation_.end(), file_rng);
+      }
+      DLOG(INFO) << "Looping around to first file.";
+    }
   }
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::PermuteRows() {
   // Default to identity permutation.
-  data_permutation_.clear();
-  data_permutation_.resize(hdf_blobs_[0]->shape(0));
-  for (int i = 0; i < hdf_blobs_[0]->shape(0); i++)
+  const int rows = chunk_->blobs_[0]->shape(0);
+  data_permutation_.resize(rows);
+  for (int i = 0; i < rows; i++)
     data_permutation_[i] = i;
 
   // Shuffle if needed.
   if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
-    DLOG(INFO) << "Successfully loaded " << hdf_blobs_[0]->shape(0)
-               << " rows (shuffled)";
-  } else {
-    DLOG(INFO) << "Successfully loaded " << hdf_blobs_[0]->shape(0) << " rows";
+    shuffle(data_permutation_.begin(), data_permutation_.end());
+  }
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      HDF5Chunk<Dtype>* chunk = chunk_free_.pop();
+      ReadChunk(chunk);
+      chunk_full_.push(chunk);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
   }
 }
 
@@ -77,6 +120,15 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  // Forget the reading state of a previous setup.
+  this->StopInternalThread();
+  if (file_id_ >= 0) {
+    H5Fclose(file_id_);
+    file_id_ = -1;
+  }
+  HDF5Chunk<Dtype>* chunk;
+  while (chunk_free_.try_pop(&chunk)) {}
+  while (chunk_full_.try_pop(&chunk)) {}
   // Read the source to parse the filenames.
   const string& source = this->layer_param_.hdf5_data_param().source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
@@ -106,22 +158,41 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   // Shuffle if needed.
   if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(file_permutation_.begin(), file_permutation_.end());
+    const unsigned int file_rng_seed = caffe_rng_rand();
+    file_rng_.reset(new Caffe::RNG(file_rng_seed));
+    caffe::rng_t* file_rng =
+        static_cast<caffe::rng_t*>(file_rng_->generator());
+    shuffle(file_permutation_.begin(), file_permutation_.end(), file_rng);
   }
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
+  // Load the first chunk and initialize the line counter.
+  chunks_.resize(2);
+  for (int i = 0; i < chunks_.size(); ++i) {
+    chunks_[i].reset(new HDF5Chunk<Dtype>());
+  }
+  chunk_ = chunks_[0].get();
+  ReadChunk(chunk_);
   current_row_ = 0;
+  PermuteRows();
+  resident_ = num_files_ == 1 && file_id_ < 0;
+  // Read the next chunks in the background, unless HDF5 was built without
+  // thread safety and they have to be read on the calling thread.
+  hbool_t threadsafe = false;
+  H5is_library_threadsafe(&threadsafe);
+  if (!resident_ && threadsafe) {
+    chunk_free_.push(chunks_[1].get());
+    this->StartInternalThread();
+  }
 
   // Reshape blobs.
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
   const int top_size = this->layer_param_.top_size();
   vector<int> top_shape;
   for (int i = 0; i < top_size; ++i) {
-    top_shape.resize(hdf_blobs_[i]->num_axes());
+    top_shape.resize(chunk_->blobs_[i]->num_axes());
     top_shape[0] = batch_size;
     for (int j = 1; j < top_shape.size(); ++j) {
-      top_shape[j] = hdf_blobs_[i]->shape(j);
+      top_shape[j] = chunk_->blobs_[i]->shape(j);
     }
     top[i]->Reshape(top_shape);
   }
@@ -139,23 +210,15 @@ bool HDF5DataLayer<Dtype>::Skip() {
 
 template<typename Dtype>
 void HDF5DataLayer<Dtype>::Next() {
-  if (++current_row_ == hdf_blobs_[0]->shape(0)) {
-    if (num_files_ > 1) {
-      ++current_file_;
-      if (current_file_ == num_files_) {
-        current_file_ = 0;
-        if (this->layer_param_.hdf5_data_param().shuffle()) {
-          std::random_shuffle(file_permutation_.begin(),
-                              file_permutation_.end());
-        }
-        DLOG(INFO) << "Looping around to first file.";
-      }
-      LoadHDF5FileData(
-        hdf_filenames_[file_permutation_[current_file_]].c_str());
+  if (++current_row_ == chunk_->blobs_[0]->shape(0)) {
+    if (this->is_started()) {
+      chunk_free_.push(chunk_);
+      chunk_ = chunk_full_.pop("Waiting for HDF5 data");
+    } else if (!resident_) {
+      ReadChunk(chunk_);
     }
     current_row_ = 0;
-    if (this->layer_param_.hdf5_data_param().shuffle())
-      std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
+    PermuteRows();
   }
   offset_++;
 }
@@ -171,7 +234,7 @@ void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     for (int j = 0; j < this->layer_param_.top_size(); ++j) {
       int data_dim = top[j]->count() / top[j]->shape(0);
       caffe_copy(data_dim,
-          &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
+          &chunk_->blobs_[j]->cpu_data()[data_permutation_[current_row_]
             * data_dim], &top[j]->mutable_cpu_data()[i * data_dim]);
     }
     Next();
@@ -1,6 +1,10 @@
 
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
+#include <stdint.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
@@ -18,9 +22,97 @@
 
 namespace caffe {
 
+static cv::Mat ReadImage(const ImageDataParameter& param,
+    const string& filename) {
+  const string path = param.root_folder() + filename;
+  if (param.reduced_decode()) {
+    return ReadImageToCVMatReduced(path, param.new_height(),
+        param.new_width(), param.is_color());
+  }
+  return ReadImageToCVMat(path, param.new_height(), param.new_width(),
+      param.is_color());
+}
+
+// Decodes the images of the layer's lines on a pool of threads, into a ring
+// of decode_queue_size slots which Pop() empties in the order of the lines.
+// A thread takes the next line and the next slot together, so the images
+// come out in the same order as when decoding on the prefetch thread.
+template <typename Dtype>
+class ImageDataLayer<Dtype>::DecodePool {
+ public:
+  DecodePool(ImageDataLayer<Dtype>* layer, int thread_count, int queue_size)
+      : layer_(layer), slots_(queue_size), next_(0), popped_(0) {
+    for (int i = 0; i < thread_count; ++i) {
+      threads_.create_thread(boost::bind(&DecodePool::Decode, this));
+    }
+  }
+  ~DecodePool() {
+    threads_.interrupt_all();
+    threads_.join_all();
+  }
+
+  // Blocks until the image of the next line is decoded.
+  void Pop(std::pair<std::string, int>* line, cv::Mat* cv_img) {
+    boost::mutex::scoped_lock lock(mutex_);
+    Slot& slot = slots_[popped_ % slots_.size()];
+    while (!slot.ready) {
+      decoded_.wait(lock);
+    }
+    *line = slot.line;
+    *cv_img = slot.cv_img;
+    slot.cv_img.release();
+    slot.ready = false;
+    ++popped_;
+    consumed_.notify_all();
+  }
+
+ protected:
+  struct Slot {
+    Slot() : ready(false) {}
+    bool ready;
+    std::pair<std::string, int> line;
+    cv::Mat cv_img;
+  };
+
+  void Decode() {
+    const ImageDataParameter& param = layer_->layer_param_.image_data_param();
+    try {
+      while (true) {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (next_ >= popped_ + slots_.size()) {
+          consumed_.wait(lock);
+        }
+        Slot& slot = slots_[next_++ % slots_.size()];
+        layer_->NextLine(&slot.line);
+        const string filename = slot.line.first;
+        lock.unlock();
+        cv::Mat cv_img = ReadImage(param, filename);
+        lock.lock();
+        slot.cv_img = cv_img;
+        slot.ready = true;
+        decoded_.notify_all();
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  ImageDataLayer<Dtype>* layer_;
+  vector<Slot> slots_;
+  // Lines handed to the threads and images popped so far.
+  uint64_t next_;
+  uint64_t popped_;
+  boost::mutex mutex_;
+  boost::condition_variable decoded_;
+  boost::condition_variable consumed_;
+  boost::thread_group threads_;
+};
+
 template <typename Dtype>
 ImageDataLayer<Dtype>::~ImageDataLayer<Dtype>() {
   this->StopInternalThread();
+  // The decode threads use lines_, so they stop before it is destroyed.
+  decode_pool_.reset();
 }
 
 template <typename Dtype>
@@ -28,8 +120,6 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int new_height = this->layer_param_.image_data_param().new_height();
   const int new_width  = this->layer_param_.image_data_param().new_width();
-  const bool is_color  = this->layer_param_.image_data_param().is_color();
-  string root_folder = this->layer_param_.image_data_param().root_folder();
 
   CHECK((new_height == 0 && new_width == 0) ||
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
@@ -73,8 +163,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     lines_id_ = skip;
   }
   // Read an image, and use it to initialize the top blob.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-                                    new_height, new_width, is_color);
+  cv::Mat cv_img = ReadImage(this->layer_param_.image_data_param(),
+                             lines_[lines_id_].first);
   CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
   // Use data_transformer to infer the expected blob shape from a cv_image.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
@@ -97,6 +187,17 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < this->prefetch_.size(); ++i) {
     this->prefetch_[i]->label_.Reshape(label_shape);
   }
+  const int decode_threads =
+      this->layer_param_.image_data_param().decode_threads();
+  if (decode_threads > 0) {
+    const int decode_queue_size =
+        this->layer_param_.image_data_param().decode_queue_size();
+    CHECK_GT(decode_queue_size, 0) << "Positive decode queue size required";
+    LOG(INFO) << "Decoding images on " << decode_threads << " threads, up to "
+        << decode_queue_size << " ahead";
+    decode_pool_.reset(
+        new DecodePool(this, decode_threads, decode_queue_size));
+  }
 }
 
 template <typename Dtype>
@@ -106,6 +207,23 @@ void ImageDataLayer<Dtype>::ShuffleImages() {
   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
 }
 
+template <typename Dtype>
+void ImageDataLayer<Dtype>::NextLine(std::pair<std::string, int>* line) {
+  const int lines_size = lines_.size();
+  CHECK_GT(lines_size, lines_id_);
+  *line = lines_[lines_id_];
+  // go to the next iter
+  lines_id_++;
+  if (lines_id_ >= lines_size) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    lines_id_ = 0;
+    if (this->layer_param_.image_data_param().shuffle()) {
+      ShuffleImages();
+    }
+  }
+}
+
 // This function is called on prefetch thread
 template <typename Dtype>
 void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
@@ -116,38 +234,37 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
   const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-  const bool is_color = image_data_param.is_color();
-  string root_folder = image_data_param.root_folder();
-
-  // Reshape according to the first image of each batch
-  // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-  // Use data_transformer to infer the expected blob shape from a cv_img.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
-  this->transformed_data_.Reshape(top_shape);
-  // Reshape batch according to the batch_size.
-  top_shape[0] = batch_size;
-  batch->data_.Reshape(top_shape);
 
-  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
+  Dtype* prefetch_data = NULL;
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
 
-  // datum scales
-  const int lines_size = lines_.size();
+  std::pair<std::string, int> line;
+  cv::Mat cv_img;
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     timer.Start();
-    CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+    if (decode_pool_) {
+      decode_pool_->Pop(&line, &cv_img);
+    } else {
+      NextLine(&line);
+      cv_img = ReadImage(image_data_param, line.first);
+    }
+    CHECK(cv_img.data) << "Could not load " << line.first;
     read_time += timer.MicroSeconds();
+    if (item_id == 0) {
+      // Reshape according to the first image of each batch
+      // on single input batches allows for inputs of varying dimension.
+      // Use data_transformer to infer the expected blob shape from a cv_img.
+      vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
+      this->transformed_data_.Reshape(top_shape);
+      // Reshape batch according to the batch_size.
+      top_shape[0] = batch_size;
+      batch->data_.Reshape(top_shape);
+      prefetch_data = batch->data_.mutable_cpu_data();
+    }
     timer.Start();
     // Apply transformations (mirror, crop...) to the image
     int offset = batch->data_.offset(item_id);
@@ -155,17 +272,7 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
     this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
     trans_time += timer.MicroSeconds();
 
-    prefetch_label[item_id] = lines_[lines_id_].second;
-    // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
-      }
-    }
+    prefetch_label[item_id] = line.second;
   }
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
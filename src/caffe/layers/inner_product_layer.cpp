@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -13,6 +14,15 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int num_output = this->layer_param_.inner_product_param().num_output();
   bias_term_ = this->layer_param_.inner_product_param().bias_term();
   transpose_ = this->layer_param_.inner_product_param().transpose();
+  dropout_ratio_ =
+      this->layer_param_.inner_product_param().input_dropout_ratio();
+  CHECK_GE(dropout_ratio_, 0.);
+  CHECK_LT(dropout_ratio_, 1.);
+  dropout_threshold_ = static_cast<unsigned int>(UINT_MAX * dropout_ratio_);
+  dropout_scale_ = 1. / (1. - dropout_ratio_);
+  LOG_IF(WARNING, dropout_ratio_ > 0 && Caffe::mode() == Caffe::GPU
+      && this->phase_ == TRAIN) << this->layer_param_.name()
+      << ": input dropout runs on the CPU, syncing its blobs every pass";
   N_ = num_output;
   const int axis = bottom[0]->CanonicalAxisIndex(
       this->layer_param_.inner_product_param().axis());
@@ -79,6 +89,26 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     bias_multiplier_.Reshape(bias_shape);
     caffe_set(M_, Dtype(1), bias_multiplier_.mutable_cpu_data());
   }
+  if (dropout_ratio_ > 0) {
+    // The masked input is only materialised a block of rows at a time, so
+    // the scratch stays around 1 MB however large the batch is.
+    const int kBlockBytes = 1 << 20;
+    dropout_block_rows_ = std::max(1, std::min(M_,
+        kBlockBytes / static_cast<int>(K_ * sizeof(Dtype))));
+    vector<int> block_shape(2);
+    block_shape[0] = dropout_block_rows_;
+    block_shape[1] = K_;
+    dropout_block_.Reshape(block_shape);
+  }
+}
+
+template <typename Dtype>
+const Dtype* InnerProductLayer<Dtype>::MaskBlock(const Dtype* bottom_data,
+    const int m0, const int rows) {
+  Dtype* block = dropout_block_.mutable_cpu_data();
+  caffe_cpu_dropout(rows * K_, dropout_threshold_, Dtype(1), dropout_seed_,
+      bottom_data + m0 * K_, block, m0 * K_);
+  return block;
 }
 
 template <typename Dtype>
@@ -87,9 +117,24 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, transpose_ ? CblasNoTrans : CblasTrans,
-      M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
+  if (dropout_ratio_ > 0 && this->phase_ == TRAIN) {
+    // Zero the dropped inputs a block of rows at a time, as other layers may
+    // read the bottom, and scale the kept ones via alpha.
+    dropout_seed_ = (static_cast<uint64_t>(caffe_rng_rand()) << 32)
+        | caffe_rng_rand();
+    for (int m0 = 0; m0 < M_; m0 += dropout_block_rows_) {
+      const int rows = std::min(dropout_block_rows_, M_ - m0);
+      caffe_cpu_gemm<Dtype>(CblasNoTrans,
+          transpose_ ? CblasNoTrans : CblasTrans,
+          rows, N_, K_, dropout_scale_,
+          MaskBlock(bottom_data, m0, rows), weight,
+          (Dtype)0., top_data + m0 * N_);
+    }
+  } else {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, transpose_ ? CblasNoTrans : CblasTrans,
+        M_, N_, K_, (Dtype)1.,
+        bottom_data, weight, (Dtype)0., top_data);
+  }
   if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.cpu_data(),
@@ -101,19 +146,43 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  if (this->param_propagate_down_[0]) {
+  // With fused dropout the mask is regenerated from the Forward seed, both
+  // for the masked input and for the bottom diff.
+  const bool dropout = dropout_ratio_ > 0 && this->phase_ == TRAIN;
+  const Dtype alpha = dropout ? dropout_scale_ : Dtype(1);
+  if (this->param_propagate_down_[0] && dropout) {
+    const Dtype* top_diff = top[0]->cpu_diff();
+    const Dtype* bottom_data = bottom[0]->cpu_data();
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    // Gradient with respect to weight, accumulated over blocks of rows
+    for (int m0 = 0; m0 < M_; m0 += dropout_block_rows_) {
+      const int rows = std::min(dropout_block_rows_, M_ - m0);
+      const Dtype* block = MaskBlock(bottom_data, m0, rows);
+      if (transpose_) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans,
+            K_, N_, rows,
+            alpha, block, top_diff + m0 * N_,
+            (Dtype)1., weight_diff);
+      } else {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans,
+            N_, K_, rows,
+            alpha, top_diff + m0 * N_, block,
+            (Dtype)1., weight_diff);
+      }
+    }
+  } else if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
     // Gradient with respect to weight
     if (transpose_) {
       caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans,
           K_, N_, M_,
-          (Dtype)1., bottom_data, top_diff,
+          alpha, bottom_data, top_diff,
           (Dtype)1., this->blobs_[0]->mutable_cpu_diff());
     } else {
       caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans,
           N_, K_, M_,
-          (Dtype)1., top_diff, bottom_data,
+          alpha, top_diff, bottom_data,
           (Dtype)1., this->blobs_[0]->mutable_cpu_diff());
     }
   }
@@ -130,14 +199,20 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     if (transpose_) {
       caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans,
           M_, K_, N_,
-          (Dtype)1., top_diff, this->blobs_[0]->cpu_data(),
+          alpha, top_diff, this->blobs_[0]->cpu_data(),
           (Dtype)0., bottom[0]->mutable_cpu_diff());
     } else {
       caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans,
           M_, K_, N_,
-          (Dtype)1., top_diff, this->blobs_[0]->cpu_data(),
+          alpha, top_diff, this->blobs_[0]->cpu_data(),
           (Dtype)0., bottom[0]->mutable_cpu_diff());
     }
+    if (dropout) {
+      // Regenerate the forward mask from its seed.
+      Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+      caffe_cpu_dropout(bottom[0]->count(), dropout_threshold_, Dtype(1),
+          dropout_seed_, bottom_diff, bottom_diff);
+    }
   }
 }
 
@@ -1,4 +1,6 @@
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layers/lrn_layer.hpp"
@@ -6,6 +8,52 @@
 
 namespace caffe {
 
+namespace {
+
+// Spatial tiles are sized so that a channels x tile block of scale values
+// (plus the matching ratios in Backward) stays in a typical 256KB L2.
+const int kLRNTileBytes = 64 * 1024;
+
+// Slides a local_size window of squared inputs down the channels of one
+// spatial tile. in points at the first pixel of the tile in channel 0, with
+// channels dim apart; n is the tile width. Writes
+// scale = k + alpha / size * (sum of squares in the window) for every channel
+// to scale + c * scale_ld. The running sum lives in sum[0, n), a contiguous
+// row the compiler vectorizes.
+template <typename Dtype>
+void lrn_fill_scale_tile(const Dtype* in, int channels, int dim, int n,
+    int size, Dtype alpha_over_size, Dtype k, Dtype* sum, Dtype* scale,
+    int scale_ld) {
+  const int pre_pad = (size - 1) / 2;
+  caffe_set(n, Dtype(0), sum);
+  for (int c = 0; c < pre_pad && c < channels; ++c) {
+    const Dtype* head = in + c * dim;
+    for (int i = 0; i < n; ++i) {
+      sum[i] += head[i] * head[i];
+    }
+  }
+  for (int c = 0; c < channels; ++c) {
+    if (c + pre_pad < channels) {
+      const Dtype* head = in + (c + pre_pad) * dim;
+      for (int i = 0; i < n; ++i) {
+        sum[i] += head[i] * head[i];
+      }
+    }
+    if (c - pre_pad - 1 >= 0) {
+      const Dtype* tail = in + (c - pre_pad - 1) * dim;
+      for (int i = 0; i < n; ++i) {
+        sum[i] -= tail[i] * tail[i];
+      }
+    }
+    Dtype* scale_row = scale + c * scale_ld;
+    for (int i = 0; i < n; ++i) {
+      scale_row[i] = k + alpha_over_size * sum[i];
+    }
+  }
+}
+
+}  // namespace
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -15,6 +63,7 @@ void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   alpha_ = this->layer_param_.lrn_param().alpha();
   beta_ = this->layer_param_.lrn_param().beta();
   k_ = this->layer_param_.lrn_param().k();
+  recompute_scale_ = this->layer_param_.lrn_param().recompute_scale();
   if (this->layer_param_.lrn_param().norm_region() ==
       LRNParameter_NormRegion_WITHIN_CHANNEL) {
     // Set up split_layer_ to use inputs in the numerator and denominator.
@@ -78,7 +127,11 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     top[0]->Reshape(num_, channels_, height_, width_);
+    // With recompute_scale the CPU path never touches scale_, so its memory
+    // is only allocated if the GPU path runs.
     scale_.Reshape(num_, channels_, height_, width_);
+    tile_size_ = std::min(height_ * width_, std::max(16,
+        kLRNTileBytes / static_cast<int>(channels_ * sizeof(Dtype))));
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
     split_layer_->Reshape(bottom, split_top_vec_);
@@ -105,51 +158,45 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+// Each image is cut into spatial tiles; a tile streams through all channels
+// with a running window sum, and (image, tile) pairs run in parallel.
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
-    }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+  Dtype* scale_data = recompute_scale_ ? NULL : scale_.mutable_cpu_data();
+  const int dim = height_ * width_;
+  const int tiles = (dim + tile_size_ - 1) / tile_size_;
+  const Dtype alpha_over_size = alpha_ / size_;
+#ifdef _OPENMP
+  #pragma omp parallel
+#endif
+  {
+    vector<Dtype> sum(tile_size_);
+    vector<Dtype> scale_tile(recompute_scale_ ? channels_ * tile_size_ : 0);
+#ifdef _OPENMP
+    #pragma omp for
+#endif
+    for (int job = 0; job < num_ * tiles; ++job) {
+      const int n = job / tiles;
+      const int start = (job % tiles) * tile_size_;
+      const int width = std::min(tile_size_, dim - start);
+      const int offset = bottom[0]->offset(n) + start;
+      Dtype* scale = recompute_scale_ ? &scale_tile[0] : scale_data + offset;
+      const int scale_ld = recompute_scale_ ? tile_size_ : dim;
+      lrn_fill_scale_tile(bottom_data + offset, channels_, dim, width, size_,
+          alpha_over_size, k_, &sum[0], scale, scale_ld);
+      for (int c = 0; c < channels_; ++c) {
+        const Dtype* in = bottom_data + offset + c * dim;
+        const Dtype* scale_row = scale + c * scale_ld;
+        Dtype* out = top_data + offset + c * dim;
+        for (int i = 0; i < width; ++i) {
+          out[i] = in[i] * std::pow(scale_row[i], -beta_);
+        }
+      }
     }
   }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
 
 template <typename Dtype>
@@ -184,50 +231,80 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* top_data = top[0]->cpu_data();
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* scale_data = scale_.cpu_data();
+  const Dtype* scale_data = recompute_scale_ ? NULL : scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
-    }
-    for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+  const int dim = height_ * width_;
+  const int tiles = (dim + tile_size_ - 1) / tile_size_;
+  const int pre_pad = (size_ - 1) / 2;
+  const Dtype alpha_over_size = alpha_ / size_;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+#ifdef _OPENMP
+  #pragma omp parallel
+#endif
+  {
+    vector<Dtype> accum_ratio(tile_size_);
+    vector<Dtype> ratio(channels_ * tile_size_);
+    vector<Dtype> scale_tile(recompute_scale_ ? channels_ * tile_size_ : 0);
+#ifdef _OPENMP
+    #pragma omp for
+#endif
+    for (int job = 0; job < num_ * tiles; ++job) {
+      const int n = job / tiles;
+      const int start = (job % tiles) * tile_size_;
+      const int width = std::min(tile_size_, dim - start);
+      const int offset = bottom[0]->offset(n) + start;
+      const Dtype* scale;
+      int scale_ld;
+      if (recompute_scale_) {
+        lrn_fill_scale_tile(bottom_data + offset, channels_, dim, width,
+            size_, alpha_over_size, k_, &accum_ratio[0], &scale_tile[0],
+            tile_size_);
+        scale = &scale_tile[0];
+        scale_ld = tile_size_;
+      } else {
+        scale = scale_data + offset;
+        scale_ld = dim;
+      }
+      // first, compute diff_i * y_i / s_i
+      for (int c = 0; c < channels_; ++c) {
+        const Dtype* diff = top_diff + offset + c * dim;
+        const Dtype* out = top_data + offset + c * dim;
+        const Dtype* scale_row = scale + c * scale_ld;
+        Dtype* ratio_row = &ratio[c * tile_size_];
+        for (int i = 0; i < width; ++i) {
+          ratio_row[i] = diff[i] * out[i] / scale_row[i];
+        }
+      }
+      // Now, slide the accumulated ratios and compute the bottom diff
+      caffe_set(width, Dtype(0), &accum_ratio[0]);
+      for (int c = 0; c < pre_pad && c < channels_; ++c) {
+        const Dtype* head = &ratio[c * tile_size_];
+        for (int i = 0; i < width; ++i) {
+          accum_ratio[i] += head[i];
+        }
+      }
+      for (int c = 0; c < channels_; ++c) {
+        if (c + pre_pad < channels_) {
+          const Dtype* head = &ratio[(c + pre_pad) * tile_size_];
+          for (int i = 0; i < width; ++i) {
+            accum_ratio[i] += head[i];
+          }
+        }
+        if (c - pre_pad - 1 >= 0) {
+          const Dtype* tail = &ratio[(c - pre_pad - 1) * tile_size_];
+          for (int i = 0; i < width; ++i) {
+            accum_ratio[i] -= tail[i];
+          }
+        }
+        const Dtype* diff = top_diff + offset + c * dim;
+        const Dtype* in = bottom_data + offset + c * dim;
+        const Dtype* scale_row = scale + c * scale_ld;
+        Dtype* out_diff = bottom_diff + offset + c * dim;
+        for (int i = 0; i < width; ++i) {
+          out_diff[i] = diff[i] * std::pow(scale_row[i], -beta_)
+              - cache_ratio_value * in[i] * accum_ratio[i];
+        }
+      }
     }
   }
 }
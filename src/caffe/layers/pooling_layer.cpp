@@ -136,104 +136,292 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
+namespace {
+
+// Geometry shared by every (n, c) plane of a pooling layer.
+struct PoolShape {
+  int height, width;
+  int pooled_height, pooled_width;
+  int kernel_h, kernel_w;
+  int stride_h, stride_w;
+  int pad_h, pad_w;
+};
+
+// Max-pools a single output, scanning the window in (h, w) order and keeping
+// the first maximum, exactly as the original serial loop did.
+template <typename Dtype, typename MaskT>
+inline void max_pool_window(const Dtype* bottom, const PoolShape& s,
+    int ph, int pw, Dtype* top, MaskT* mask) {
+  int hstart = ph * s.stride_h - s.pad_h;
+  int wstart = pw * s.stride_w - s.pad_w;
+  const int hend = min(hstart + s.kernel_h, s.height);
+  const int wend = min(wstart + s.kernel_w, s.width);
+  hstart = max(hstart, 0);
+  wstart = max(wstart, 0);
+  Dtype maxval = -FLT_MAX;
+  int maxidx = -1;
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      const int index = h * s.width + w;
+      if (bottom[index] > maxval) {
+        maxval = bottom[index];
+        maxidx = index;
+      }
+    }
+  }
+  const int pool_index = ph * s.pooled_width + pw;
+  top[pool_index] = maxval;
+  mask[pool_index] = static_cast<MaskT>(maxidx);
+}
+
+template <typename Dtype>
+inline Dtype ave_pool_window(const Dtype* bottom, const PoolShape& s,
+    int ph, int pw) {
+  int hstart = ph * s.stride_h - s.pad_h;
+  int wstart = pw * s.stride_w - s.pad_w;
+  int hend = min(hstart + s.kernel_h, s.height + s.pad_h);
+  int wend = min(wstart + s.kernel_w, s.width + s.pad_w);
+  const int pool_size = (hend - hstart) * (wend - wstart);
+  hstart = max(hstart, 0);
+  wstart = max(wstart, 0);
+  hend = min(hend, s.height);
+  wend = min(wend, s.width);
+  Dtype sum = 0;
+  for (int h = hstart; h < hend; ++h) {
+    for (int w = wstart; w < wend; ++w) {
+      sum += bottom[h * s.width + w];
+    }
+  }
+  return sum / pool_size;
+}
+
+// Range [lo, hi) of pooled positions along one axis whose K-wide window lies
+// entirely inside the input, i.e. needs neither padding nor clipping.
+inline void interior_range(int pooled, int size, int pad, int stride,
+    int kernel, int* lo, int* hi) {
+  *lo = min((pad + stride - 1) / stride, pooled);
+  *hi = size + pad >= kernel ?
+      min((size + pad - kernel) / stride + 1, pooled) : 0;
+  *hi = max(*hi, *lo);
+}
+
+// Max-pools one plane. With K > 0 the interior uses a fixed K x K, stride S
+// window whose innermost loop runs across a row of outputs, which the
+// compiler turns into strided SIMD compare-and-select; the window is still
+// visited in (h, w) order so ties pick the same argmax as the generic loop.
+// Border outputs, and every output when K == 0, take the generic path.
+template <typename Dtype, typename MaskT, int K, int S>
+void max_pool_plane(const Dtype* bottom, const PoolShape& s,
+    Dtype* top, MaskT* mask) {
+  int ph_lo = 0, ph_hi = 0, pw_lo = 0, pw_hi = 0;
+  if (K > 0) {
+    interior_range(s.pooled_height, s.height, s.pad_h, S, K, &ph_lo, &ph_hi);
+    interior_range(s.pooled_width, s.width, s.pad_w, S, K, &pw_lo, &pw_hi);
+  }
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    if (K == 0 || ph < ph_lo || ph >= ph_hi || pw_lo == pw_hi) {
+      for (int pw = 0; pw < s.pooled_width; ++pw) {
+        max_pool_window(bottom, s, ph, pw, top, mask);
+      }
+      continue;
+    }
+    for (int pw = 0; pw < pw_lo; ++pw) {
+      max_pool_window(bottom, s, ph, pw, top, mask);
+    }
+    const int n = pw_hi - pw_lo;
+    const int hstart = ph * S - s.pad_h;
+    const int wstart = pw_lo * S - s.pad_w;
+    Dtype* row_top = top + ph * s.pooled_width + pw_lo;
+    MaskT* row_mask = mask + ph * s.pooled_width + pw_lo;
+    for (int i = 0; i < n; ++i) {
+      row_top[i] = -FLT_MAX;
+      row_mask[i] = static_cast<MaskT>(-1);
+    }
+    for (int kh = 0; kh < K; ++kh) {
+      const int row_index = (hstart + kh) * s.width + wstart;
+      const Dtype* row = bottom + row_index;
+      for (int kw = 0; kw < K; ++kw) {
+        for (int i = 0; i < n; ++i) {
+          const Dtype v = row[i * S + kw];
+          const bool take = v > row_top[i];
+          row_top[i] = take ? v : row_top[i];
+          row_mask[i] = take ?
+              static_cast<MaskT>(row_index + i * S + kw) : row_mask[i];
+        }
+      }
+    }
+    for (int pw = pw_hi; pw < s.pooled_width; ++pw) {
+      max_pool_window(bottom, s, ph, pw, top, mask);
+    }
+  }
+}
+
+// Average-pools one plane; same interior/border split as max_pool_plane.
+// Each interior output sums its window in (h, w) order before dividing, so
+// the result is bit-identical to the generic path.
+template <typename Dtype, int K, int S>
+void ave_pool_plane(const Dtype* bottom, const PoolShape& s, Dtype* top) {
+  int ph_lo = 0, ph_hi = 0, pw_lo = 0, pw_hi = 0;
+  if (K > 0) {
+    interior_range(s.pooled_height, s.height, s.pad_h, S, K, &ph_lo, &ph_hi);
+    interior_range(s.pooled_width, s.width, s.pad_w, S, K, &pw_lo, &pw_hi);
+  }
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    Dtype* row_top = top + ph * s.pooled_width;
+    if (K == 0 || ph < ph_lo || ph >= ph_hi || pw_lo == pw_hi) {
+      for (int pw = 0; pw < s.pooled_width; ++pw) {
+        row_top[pw] = ave_pool_window(bottom, s, ph, pw);
+      }
+      continue;
+    }
+    for (int pw = 0; pw < pw_lo; ++pw) {
+      row_top[pw] = ave_pool_window(bottom, s, ph, pw);
+    }
+    const int n = pw_hi - pw_lo;
+    const int hstart = ph * S - s.pad_h;
+    const int wstart = pw_lo * S - s.pad_w;
+    Dtype* out = row_top + pw_lo;
+    for (int i = 0; i < n; ++i) {
+      out[i] = 0;
+    }
+    for (int kh = 0; kh < K; ++kh) {
+      const Dtype* row = bottom + (hstart + kh) * s.width + wstart;
+      for (int kw = 0; kw < K; ++kw) {
+        for (int i = 0; i < n; ++i) {
+          out[i] += row[i * S + kw];
+        }
+      }
+    }
+    for (int i = 0; i < n; ++i) {
+      out[i] /= K * K;
+    }
+    for (int pw = pw_hi; pw < s.pooled_width; ++pw) {
+      row_top[pw] = ave_pool_window(bottom, s, ph, pw);
+    }
+  }
+}
+
+// Test-time stochastic pooling: the probability-weighted average
+// sum(x^2) / sum(x) over each window, as in StoPoolForwardTest.
+template <typename Dtype>
+void sto_pool_test_plane(const Dtype* bottom, const PoolShape& s,
+    Dtype* top) {
+  for (int ph = 0; ph < s.pooled_height; ++ph) {
+    for (int pw = 0; pw < s.pooled_width; ++pw) {
+      const int hstart = ph * s.stride_h;
+      const int hend = min(hstart + s.kernel_h, s.height);
+      const int wstart = pw * s.stride_w;
+      const int wend = min(wstart + s.kernel_w, s.width);
+      Dtype cumsum = 0.;
+      Dtype cumvalues = 0.;
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = wstart; w < wend; ++w) {
+          cumsum += bottom[h * s.width + w];
+          cumvalues += bottom[h * s.width + w] * bottom[h * s.width + w];
+        }
+      }
+      top[ph * s.pooled_width + pw] = (cumsum > 0.) ? cumvalues / cumsum : 0.;
+    }
+  }
+}
+
+// Kernel sizes with a specialized plane loop: 3x3 and 2x2 at stride 2 cover
+// the pooling layers of CaffeNet/AlexNet, VGG, GoogLeNet and ResNet.
+inline int fixed_kernel(const PoolShape& s) {
+  if (s.kernel_h == s.kernel_w && s.stride_h == 2 && s.stride_w == 2 &&
+      (s.kernel_h == 3 || s.kernel_h == 2)) {
+    return s.kernel_h;
+  }
+  return 0;
+}
+
+template <typename Dtype, typename MaskT>
+void max_pool_planes(const Dtype* bottom_data, const PoolShape& s,
+    int num_planes, Dtype* top_data, MaskT* mask) {
+  const int bottom_dim = s.height * s.width;
+  const int top_dim = s.pooled_height * s.pooled_width;
+  const int k = fixed_kernel(s);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < num_planes; ++p) {
+    const Dtype* bottom = bottom_data + p * bottom_dim;
+    Dtype* top = top_data + p * top_dim;
+    MaskT* plane_mask = mask + p * top_dim;
+    if (k == 3) {
+      max_pool_plane<Dtype, MaskT, 3, 2>(bottom, s, top, plane_mask);
+    } else if (k == 2) {
+      max_pool_plane<Dtype, MaskT, 2, 2>(bottom, s, top, plane_mask);
+    } else {
+      max_pool_plane<Dtype, MaskT, 0, 1>(bottom, s, top, plane_mask);
+    }
+  }
+}
+
+template <typename Dtype>
+void ave_pool_planes(const Dtype* bottom_data, const PoolShape& s,
+    int num_planes, Dtype* top_data) {
+  const int bottom_dim = s.height * s.width;
+  const int top_dim = s.pooled_height * s.pooled_width;
+  const int k = fixed_kernel(s);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int p = 0; p < num_planes; ++p) {
+    const Dtype* bottom = bottom_data + p * bottom_dim;
+    Dtype* top = top_data + p * top_dim;
+    if (k == 3) {
+      ave_pool_plane<Dtype, 3, 2>(bottom, s, top);
+    } else if (k == 2) {
+      ave_pool_plane<Dtype, 2, 2>(bottom, s, top);
+    } else {
+      ave_pool_plane<Dtype, 0, 1>(bottom, s, top);
+    }
+  }
+}
+
+}  // namespace
+
+// Every (n, c) plane is pooled independently, so the planes are distributed
+// across OpenMP threads (when built with USE_OPENMP) and each output is
+// written exactly once, with no -FLT_MAX prefill pass over top.
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
-  // We'll output the mask to top[1] if it's of size >1.
-  const bool use_top_mask = top.size() > 1;
-  int* mask = NULL;  // suppress warnings about uninitialized variables
-  Dtype* top_mask = NULL;
+  const int num_planes = bottom[0]->num() * channels_;
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  const PoolShape shape = { height_, width_, pooled_height_, pooled_width_,
+      kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_ };
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
-    if (use_top_mask) {
-      top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
+    // We'll output the mask to top[1] if it's of size >1.
+    if (top.size() > 1) {
+      max_pool_planes(bottom_data, shape, num_planes, top_data,
+          top[1]->mutable_cpu_data());
     } else {
-      mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
-    }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
-      }
+      max_pool_planes(bottom_data, shape, num_planes, top_data,
+          max_idx_.mutable_cpu_data());
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
-    }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-      }
-    }
+    ave_pool_planes(bottom_data, shape, num_planes, top_data);
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
+    if (this->phase_ == TRAIN) {
+      NOT_IMPLEMENTED;
+    }
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int p = 0; p < num_planes; ++p) {
+      sto_pool_test_plane(bottom_data + p * bottom_dim, shape,
+          top_data + p * top_dim);
+    }
     break;
   default:
     LOG(FATAL) << "Unknown pooling method.";
@@ -248,67 +436,71 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int num_planes = top[0]->num() * channels_;
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   const int* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
+  // Different pooling methods. We explicitly do the switch outside the for
+  // loop to save time, although this results in more codes. Each plane only
+  // scatters into its own slice of bottom_diff, so planes run in parallel and
+  // clear their slice themselves.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
     } else {
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int p = 0; p < num_planes; ++p) {
+      Dtype* plane_bottom_diff = bottom_diff + p * bottom_dim;
+      const Dtype* plane_top_diff = top_diff + p * top_dim;
+      caffe_set(bottom_dim, Dtype(0), plane_bottom_diff);
+      if (use_top_mask) {
+        const Dtype* plane_mask = top_mask + p * top_dim;
+        for (int index = 0; index < top_dim; ++index) {
+          const int bottom_index = static_cast<int>(plane_mask[index]);
+          plane_bottom_diff[bottom_index] += plane_top_diff[index];
         }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
+      } else {
+        const int* plane_mask = mask + p * top_dim;
+        for (int index = 0; index < top_dim; ++index) {
+          plane_bottom_diff[plane_mask[index]] += plane_top_diff[index];
         }
       }
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int p = 0; p < num_planes; ++p) {
+      Dtype* plane_bottom_diff = bottom_diff + p * bottom_dim;
+      const Dtype* plane_top_diff = top_diff + p * top_dim;
+      caffe_set(bottom_dim, Dtype(0), plane_bottom_diff);
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_h_ - pad_h_;
+          int wstart = pw * stride_w_ - pad_w_;
+          int hend = min(hstart + kernel_h_, height_ + pad_h_);
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          int pool_size = (hend - hstart) * (wend - wstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              plane_bottom_diff[h * width_ + w] +=
+                plane_top_diff[ph * pooled_width_ + pw] / pool_size;
             }
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
       }
     }
     break;
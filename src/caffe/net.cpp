@@ -1,4 +1,5 @@
 
+#include <boost/filesystem.hpp>
 #include <algorithm>
 #include <map>
 #include <set>
@@ -19,6 +20,7 @@
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weights_file.hpp"
 
 namespace caffe {
 
@@ -732,6 +734,28 @@ void Net<Dtype>::Reshape() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFrom(const Net* other) {
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (!other->has_layer(layer_names_[i])) {
+      continue;
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& source_blobs =
+        other->layer_by_name(layer_names_[i])->blobs();
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs = layers_[i]->blobs();
+    CHECK_EQ(target_blobs.size(), source_blobs.size())
+        << "Incompatible number of blobs for layer " << layer_names_[i];
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      CHECK(target_blobs[j]->shape() == source_blobs[j]->shape())
+          << "Cannot copy param " << j << " weights from layer '"
+          << layer_names_[i] << "'; shape mismatch.  Source param shape is "
+          << source_blobs[j]->shape_string() << "; target param shape is "
+          << target_blobs[j]->shape_string();
+      target_blobs[j]->CopyFrom(*source_blobs[j]);
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   int num_source_layers = param.layer_size();
@@ -774,6 +798,8 @@ template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const string& trained_filename) {
   if (H5Fis_hdf5(trained_filename.c_str())) {
     CopyTrainedLayersFromHDF5(trained_filename);
+  } else if (WeightsFile::IsWeightsFile(trained_filename)) {
+    CopyTrainedLayersFromWeightsFile(trained_filename);
   } else {
     CopyTrainedLayersFromBinaryProto(trained_filename);
   }
@@ -784,9 +810,48 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
     const string& trained_filename) {
   NetParameter param;
   ReadNetParamsFromBinaryFileOrDie(trained_filename, &param);
+  if (param.has_base_weights()) {
+    // A delta snapshot: load the layers that did not change from its base,
+    // which lies next to it.
+    const boost::filesystem::path base =
+        boost::filesystem::path(trained_filename).parent_path() /
+        boost::filesystem::path(param.base_weights()).filename();
+    CopyTrainedLayersFrom(base.string());
+  }
   CopyTrainedLayersFrom(param);
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFromWeightsFile(
+    const string& trained_filename) {
+  const WeightsFile weights(trained_filename);
+  const NetParameter& index = weights.index();
+  for (int i = 0; i < index.layer_size(); ++i) {
+    const LayerParameter& source_layer = index.layer(i);
+    const string& source_layer_name = source_layer.name();
+    if (!layer_names_index_.count(source_layer_name)) {
+      LOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    int target_layer_id = layer_names_index_[source_layer_name];
+    DLOG(INFO) << "Copying source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      if (!target_blobs[j]->ShapeEquals(source_layer.blobs(j))) {
+        LOG(FATAL) << "Cannot copy param " << j << " weights from layer '"
+            << source_layer_name << "'; shape mismatch.  Target param shape "
+            << "is " << target_blobs[j]->shape_string() << ". "
+            << "To learn this layer's parameters from scratch rather than "
+            << "copying from a saved net, rename the layer.";
+      }
+      weights.CopyBlob(i, j, target_blobs[j].get());
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string& trained_filename) {
 #ifdef USE_HDF5
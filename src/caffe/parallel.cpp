@@ -1,9 +1,21 @@
 
 #ifdef USE_NCCL
-
 #include <cuda_runtime.h>
+#endif
 #include <glog/logging.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -11,9 +23,12 @@
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/sgd_solvers.hpp"
+#include "caffe/util/quantize.hpp"
 
 namespace caffe {
 
+namespace bip = boost::interprocess;
+
 enum Op {
   copy,
   replace_cpu,
@@ -73,6 +88,430 @@ Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
     diff_() {
 }
 
+template<typename Dtype>
+ReduceBuckets<Dtype>::ReduceBuckets(const Net<Dtype>& net,
+                                    size_t bucket_size)
+  : ready_(net.layers().size(), -1) {
+  const vector<Blob<Dtype>*>& params = net.learnable_params();
+  vector<size_t> offsets(params.size() + 1, 0);
+  for (int i = 0; i < params.size(); ++i) {
+    offsets[i + 1] = offsets[i] + params[i]->count();
+  }
+  // The gradient of a param is final once its lowest layer, which owns it
+  // and comes first in the buffer, has run backward.
+  vector<int> lowest_layer(params.size(), net.layers().size());
+  for (int i = 0; i < net.params().size(); ++i) {
+    const int param_id = net.learnable_param_ids()[i];
+    lowest_layer[param_id] = std::min(lowest_layer[param_id],
+        net.param_layer_indices()[i].first);
+  }
+  vector<size_t> layer_begin(net.layers().size(), offsets.back());
+  for (int param_id = 0; param_id < params.size(); ++param_id) {
+    size_t& begin = layer_begin[lowest_layer[param_id]];
+    begin = std::min(begin, offsets[param_id]);
+  }
+  // Walk layers in backward order, closing a bucket whenever the pending
+  // gradients reach bucket_size, and at the lowest layer with params.
+  size_t end = offsets.back();
+  int lowest = -1;
+  for (int i = net.layers().size() - 1; i >= 0; --i) {
+    if (layer_begin[i] >= end) {  // No params of its own
+      continue;
+    }
+    lowest = i;
+    if ((end - layer_begin[i]) * sizeof(Dtype) >= bucket_size) {
+      ready_[i] = begin_.size();
+      begin_.push_back(layer_begin[i]);
+      end_.push_back(end);
+      end = layer_begin[i];
+    }
+  }
+  if (end > 0) {
+    ready_[lowest] = begin_.size();
+    begin_.push_back(0);
+    end_.push_back(end);
+  }
+}
+
+// Marks a shared segment whose creator has finished initializing it.
+static const uint64_t kAllReduceMagic = 0x4361666665415231ULL;
+// Gradient buffers and the chunks each worker reduces start on cache lines,
+// so that workers never write to the same ones.
+static const size_t kAllReduceAlignment = 64;
+
+static size_t allreduce_align(size_t bytes) {
+  return (bytes + kAllReduceAlignment - 1) / kAllReduceAlignment
+      * kAllReduceAlignment;
+}
+
+// Compressed gradients of a bucket, followed by their codes. A step of 0
+// marks raw values, for gradients that would not get smaller.
+struct BucketCodes {
+  double step;
+  uint64_t size;
+};
+
+template<typename Dtype>
+struct SharedMemoryAllReduce<Dtype>::Header {
+  uint64_t magic;
+  uint64_t worker_count;
+  uint64_t size;
+  // Barrier state: workers arrived at the current barrier, and how many
+  // barriers all workers passed.
+  uint64_t arrived;
+  uint64_t generation;
+  bip::interprocess_mutex mutex;
+  bip::interprocess_condition condition;
+};
+
+template<typename Dtype>
+SharedMemoryAllReduce<Dtype>::SharedMemoryAllReduce(
+    shared_ptr<Solver<Dtype> > solver)
+  : Params<Dtype>(solver), solver_(solver), header_(),
+    exchanged_bytes_(), full_bytes_(), exchanges_() {
+  ostringstream name;
+  name << "caffe_allreduce_" << getpid() << "_" << this;
+  shared_name_ = name.str();
+  Init();
+}
+
+template<typename Dtype>
+SharedMemoryAllReduce<Dtype>::SharedMemoryAllReduce(
+    shared_ptr<Solver<Dtype> > solver, const string& shared_name)
+  : Params<Dtype>(solver), solver_(solver), shared_name_(shared_name),
+    header_(), exchanged_bytes_(), full_bytes_(), exchanges_() {
+  Init();
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::Init() {
+  rank_ = Caffe::solver_rank();
+  worker_count_ = Caffe::solver_count();
+  CHECK_LT(rank_, worker_count_);
+  const SolverParameter& param = solver_->param();
+  // Without layer_wise_reduce, all gradients go in one bucket.
+  buckets_.reset(new ReduceBuckets<Dtype>(*solver_->net(),
+      param.layer_wise_reduce() ? param.reduce_bucket_size() :
+      std::numeric_limits<size_t>::max()));
+  compression_error_ = param.gradient_compression_error();
+  CHECK_GE(compression_error_, 0);
+  // Compressed gradients get an area of their own after the buffers.
+  codes_offsets_.assign(1, 0);
+  if (compression_error_ > 0) {
+    for (int i = 0; i < buckets_->size(); ++i) {
+      codes_offsets_.push_back(codes_offsets_.back() +
+          allreduce_align(sizeof(BucketCodes) + sizeof(Dtype) *
+          (buckets_->end(i) - buckets_->begin(i))));
+    }
+    residual_.assign(size_, Dtype(0));
+    decoded_.resize(size_);
+  }
+  const size_t bytes = allreduce_align(sizeof(Header)) +
+      worker_count_ * allreduce_align(size_ * sizeof(Dtype)) +
+      worker_count_ * codes_offsets_.back();
+  try {
+    bip::shared_memory_object shm(bip::create_only, shared_name_.c_str(),
+        bip::read_write);
+    shm.truncate(bytes);
+    bip::mapped_region region(shm, bip::read_write);
+    region_.swap(region);
+    // Mapped pages start out zeroed, buffers included.
+    header_ = static_cast<Header*>(region_.get_address());
+    header_->worker_count = worker_count_;
+    header_->size = size_;
+    header_->arrived = 0;
+    header_->generation = 0;
+    new (&header_->mutex) bip::interprocess_mutex();
+    new (&header_->condition) bip::interprocess_condition();
+    *static_cast<volatile uint64_t*>(&header_->magic) = kAllReduceMagic;
+  } catch (const bip::interprocess_exception& e) {
+    CHECK_EQ(e.get_error_code(), bip::already_exists_error)
+        << "Cannot create shared memory " << shared_name_ << ": "
+        << e.what();
+    // Wait for the creator of the segment to size and initialize it.
+    bip::shared_memory_object shm(bip::open_only, shared_name_.c_str(),
+        bip::read_write);
+    const int kRetries = 1000;
+    bip::offset_t shm_size = 0;
+    for (int i = 0; i < kRetries && (!shm.get_size(shm_size) ||
+         shm_size < static_cast<bip::offset_t>(bytes)); ++i) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    CHECK_EQ(shm_size, static_cast<bip::offset_t>(bytes))
+        << "Workers disagree on the number of workers or parameters.";
+    bip::mapped_region region(shm, bip::read_write);
+    region_.swap(region);
+    header_ = static_cast<Header*>(region_.get_address());
+    for (int i = 0; i < kRetries &&
+         *static_cast<volatile uint64_t*>(&header_->magic) != kAllReduceMagic;
+         ++i) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    CHECK_EQ(header_->magic, kAllReduceMagic) << "Shared memory "
+        << shared_name_ << " was never initialized; remove it and restart.";
+    CHECK_EQ(header_->worker_count, worker_count_)
+        << "Workers disagree on the number of workers.";
+    CHECK_EQ(header_->size, size_)
+        << "Workers disagree on the number of parameters.";
+  }
+  // Weights stay private; gradients go straight to the buffer of this
+  // worker.
+  data_ = new Dtype[size_];
+  diff_ = buffer(rank_);
+  const vector<Blob<Dtype>*>& net = solver_->net()->learnable_params();
+  apply_buffers(net, data_, size_, copy);
+  apply_buffers(net, data_, size_, replace_cpu);
+  apply_buffers(net, diff_, size_, replace_cpu_diff);
+  if (param.layer_wise_reduce()) {
+    StartInternalThread();
+  }
+}
+
+template<typename Dtype>
+SharedMemoryAllReduce<Dtype>::~SharedMemoryAllReduce() {
+  // A CPUWorker may be asked to stop while it gets here, which must not
+  // cut short the join of the reduction thread.
+  boost::this_thread::disable_interruption no_interruption;
+  StopInternalThread();
+  if (rank_ == 0) {
+    bip::shared_memory_object::remove(shared_name_.c_str());
+  }
+  delete[] data_;
+}
+
+template<typename Dtype>
+Dtype* SharedMemoryAllReduce<Dtype>::buffer(int rank) const {
+  return reinterpret_cast<Dtype*>(static_cast<char*>(region_.get_address()) +
+      allreduce_align(sizeof(Header)) +
+      rank * allreduce_align(size_ * sizeof(Dtype)));
+}
+
+template<typename Dtype>
+char* SharedMemoryAllReduce<Dtype>::codes(int rank, int bucket) const {
+  return static_cast<char*>(region_.get_address()) +
+      allreduce_align(sizeof(Header)) +
+      worker_count_ * allreduce_align(size_ * sizeof(Dtype)) +
+      rank * codes_offsets_.back() + codes_offsets_[bucket];
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::Barrier() {
+  bip::scoped_lock<bip::interprocess_mutex> lock(header_->mutex);
+  const uint64_t generation = header_->generation;
+  if (++header_->arrived == header_->worker_count) {
+    header_->arrived = 0;
+    ++header_->generation;
+    header_->condition.notify_all();
+  } else {
+    while (header_->generation == generation) {
+      header_->condition.wait(lock);
+    }
+  }
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::Broadcast() {
+  // Wait for all workers to map the segment.
+  Barrier();
+  if (rank_ == 0) {
+    // Unlink it, so that it goes away with the last worker however they end.
+    bip::shared_memory_object::remove(shared_name_.c_str());
+    caffe_copy(static_cast<int>(size_), data_, buffer(0));
+  }
+  Barrier();
+  if (rank_ != 0) {
+    caffe_copy(static_cast<int>(size_), buffer(0), data_);
+  }
+  // Rank 0 overwrites its buffer with gradients next.
+  Barrier();
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::Reduce(size_t begin, size_t end) {
+  Barrier();
+  // Reduce-scatter and allgather in one pass: this worker averages its
+  // chunk of whole cache lines over all buffers, then copies the average
+  // back to them. The last workers may get a short chunk, or none.
+  const size_t line = kAllReduceAlignment / sizeof(Dtype);
+  const size_t chunk = (end - begin + worker_count_ * line - 1) /
+      (worker_count_ * line) * line;
+  const size_t first = std::min(end, begin + rank_ * chunk);
+  const int count = static_cast<int>(std::min(end, first + chunk) - first);
+  if (count > 0) {
+    Dtype* average = buffer(rank_) + first;
+    for (int i = 0; i < worker_count_; ++i) {
+      if (i != rank_) {
+        caffe_axpy(count, Dtype(1), buffer(i) + first, average);
+      }
+    }
+    caffe_scal(count, Dtype(1) / worker_count_, average);
+    for (int i = 0; i < worker_count_; ++i) {
+      if (i != rank_) {
+        caffe_copy(count, average, buffer(i) + first);
+      }
+    }
+  }
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::ReduceCompressed(int bucket) {
+  const size_t begin = buckets_->begin(bucket);
+  const int count = static_cast<int>(buckets_->end(bucket) - begin);
+  Dtype* diff = diff_ + begin;
+  Dtype* residual = &residual_[begin];
+  Dtype* decoded = &decoded_[begin];
+  // Error feedback: send what earlier gradients left out along with this
+  // one.
+  caffe_axpy(count, Dtype(1), diff, residual);
+  char* own = codes(rank_, bucket);
+  BucketCodes header;
+  if (QuantizeData(residual, count, compression_error_, &quantized_)) {
+    header.step = quantized_.step();
+    header.size = quantized_.codes().size();
+    memcpy(own + sizeof(header), quantized_.codes().data(), header.size);
+  } else {
+    header.step = 0;
+    header.size = count * sizeof(Dtype);
+    memcpy(own + sizeof(header), residual, header.size);
+  }
+  memcpy(own, &header, sizeof(header));
+  exchanged_bytes_ += sizeof(header) + header.size;
+  full_bytes_ += count * sizeof(Dtype);
+  Barrier();
+  // Every worker sums the same values in the same order, so that weights
+  // stay identical.
+  caffe_set(count, Dtype(0), diff);
+  for (int i = 0; i < worker_count_; ++i) {
+    const char* other = codes(i, bucket);
+    memcpy(&header, other, sizeof(header));
+    if (header.step > 0) {
+      DequantizeCodes(other + sizeof(header), header.size, header.step,
+          count, decoded);
+    } else {
+      memcpy(decoded, other + sizeof(header), header.size);
+    }
+    if (i == rank_) {
+      caffe_axpy(count, Dtype(-1), decoded, residual);
+    }
+    caffe_axpy(count, Dtype(1), decoded, diff);
+  }
+  caffe_scal(count, Dtype(1) / worker_count_, diff);
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::ReduceBucket(int bucket) {
+  if (compression_error_ > 0) {
+    ReduceCompressed(bucket);
+  } else {
+    Reduce(buckets_->begin(bucket), buckets_->end(bucket));
+  }
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::run(int layer) {
+  CHECK(solver_->param().layer_wise_reduce());
+  const int bucket = buckets_->ready(layer);
+  if (bucket >= 0) {
+    ready_.push(bucket);
+    if (bucket == buckets_->size() - 1) {
+      // Backward may run again before the update with iter_size > 1.
+      done_.pop();
+    }
+  }
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::on_gradients_ready() {
+  if (!solver_->param().layer_wise_reduce()) {
+    for (int i = 0; i < buckets_->size(); ++i) {
+      ReduceBucket(i);
+    }
+    Barrier();
+  }
+  ++exchanges_;
+  const int display = solver_->param().display();
+  if (compression_error_ > 0 && rank_ == 0 && display &&
+      solver_->iter() % display == 0 && full_bytes_ > 0) {
+    LOG(INFO) << "    Gradients sent: " << exchanged_bytes_ / exchanges_
+        << " bytes per iteration, "
+        << 100. * exchanged_bytes_ / full_bytes_ << "% of full precision";
+    exchanged_bytes_ = 0;
+    full_bytes_ = 0;
+    exchanges_ = 0;
+  }
+}
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      const int bucket = ready_.pop();
+      ReduceBucket(bucket);
+      if (bucket == buckets_->size() - 1) {
+        // No worker may go on before all averages are in its buffer.
+        Barrier();
+        done_.push(bucket);
+      }
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template<typename Dtype>
+class CPUWorker : public InternalThread {
+ public:
+  CPUWorker(shared_ptr<Solver<Dtype> > rank0, const string& shared_name,
+            const char* restore)
+    : rank0_(rank0), shared_name_(shared_name), restore_(restore) {
+  }
+  virtual ~CPUWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+    SolverParameter param(rank0_->param());
+    param.set_type(rank0_->type());
+    shared_ptr<Solver<Dtype> > s(SolverRegistry<Dtype>::CreateSolver(param));
+    CHECK_EQ(s->type(), rank0_->type());
+    if (restore_) {
+      s->Restore(restore_);
+    }
+    SharedMemoryAllReduce<Dtype> allreduce(s, shared_name_);
+    s->add_callback(&allreduce);
+    if (s->param().layer_wise_reduce()) {
+      s->net()->add_after_backward(&allreduce);
+    }
+    allreduce.Broadcast();
+    s->Step(param.max_iter() - s->iter());
+  }
+
+  shared_ptr<Solver<Dtype> > rank0_;
+  string shared_name_;
+  const char* restore_;
+};
+
+template<typename Dtype>
+void SharedMemoryAllReduce<Dtype>::Run(const char* restore) {
+  vector<shared_ptr<CPUWorker<Dtype> > > workers(worker_count_);
+  for (int i = 1; i < worker_count_; ++i) {
+    Caffe::set_solver_rank(i);
+    workers[i].reset(new CPUWorker<Dtype>(solver_, shared_name_, restore));
+    workers[i]->StartInternalThread();
+  }
+  Caffe::set_solver_rank(0);
+  solver_->add_callback(this);
+  if (solver_->param().layer_wise_reduce()) {
+    solver_->net()->add_after_backward(this);
+  }
+  Broadcast();
+  solver_->Solve();
+  for (int i = 1; i < worker_count_; ++i) {
+    workers[i]->StopInternalThread();
+  }
+}
+
+#ifdef USE_NCCL
+
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
   : Params<Dtype>(root_solver) {
@@ -141,6 +580,8 @@ template<typename Dtype>
 void NCCL<Dtype>::Init() {
   if (solver_->param().layer_wise_reduce()) {
     CUDA_CHECK(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+    buckets_.reset(new ReduceBuckets<Dtype>(*solver_->net(),
+        solver_->param().reduce_bucket_size()));
   }
 }
 
@@ -202,46 +643,31 @@ void NCCL<Dtype>::Broadcast() {
 template<typename Dtype>
 void NCCL<Dtype>::run(int layer) {
   CHECK(solver_->param().layer_wise_reduce());
-  vector<shared_ptr<Blob<Dtype> > >& blobs =
-    solver_->net()->layers()[layer]->blobs();
-#ifdef DEBUG
-  // Assert blobs are contiguous to reduce in one step (e.g. bias often small)
-  for (int i = 1; i < blobs.size(); ++i) {
-    CHECK_EQ(blobs[i - 1]->gpu_diff() + blobs[i - 1]->count(),
-             blobs[i + 0]->gpu_diff());
-  }
-#endif
-  if (blobs.size() > 0) {
+  const int bucket = buckets_->ready(layer);
+  if (bucket >= 0) {
     // Make sure default stream is done computing gradients. Could be
     // replaced by cudaEventRecord+cudaStreamWaitEvent to avoid
     // blocking the default stream, but it's actually slower.
     CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
 
     // Reduce asynchronously
-    int size = 0;
-    for (int i = 0; i < blobs.size(); ++i) {
-      size += blobs[i]->count();
-    }
+    Dtype* diff = diff_ + buckets_->begin(bucket);
+    int size = static_cast<int>(buckets_->end(bucket) -
+                                buckets_->begin(bucket));
     if (barrier_) {  // NULL in multi process case
       barrier_->wait();
     }
-    NCCL_CHECK(ncclAllReduce(blobs[0]->mutable_gpu_diff(),
-                             blobs[0]->mutable_gpu_diff(),
-                             size,
+    NCCL_CHECK(ncclAllReduce(diff, diff, size,
                              nccl::dataType<Dtype>::type,
                              ncclSum, comm_, stream_));
-    caffe_gpu_scal(size, (Dtype) 1.0 / Caffe::solver_count(),
-                   blobs[0]->mutable_gpu_diff(), stream_);
+    caffe_gpu_scal(size, (Dtype) 1.0 / Caffe::solver_count(), diff,
+                   stream_);
   }
 }
 
 template<typename Dtype>
 void NCCL<Dtype>::on_gradients_ready() {
   if (solver_->param().layer_wise_reduce()) {
-    CHECK_EQ(solver_->net()->params().size(),
-             solver_->net()->learnable_params().size())
-      << "Layer-wise reduce is not supported for nets with shared weights.";
-
     // Make sure reduction is done before applying gradients
     CUDA_CHECK(cudaStreamSynchronize(stream_));
   } else {
@@ -362,11 +788,15 @@ void NCCL<Dtype>::Run(const vector<int>& gpus, const char* restore) {
   }
 }
 
-INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(Worker);
 INSTANTIATE_CLASS(NCCL);
 
-}  // namespace caffe
+#endif  // USE_NCCL
+
+INSTANTIATE_CLASS(Params);
+INSTANTIATE_CLASS(ReduceBuckets);
+INSTANTIATE_CLASS(SharedMemoryAllReduce);
+INSTANTIATE_CLASS(CPUWorker);
 
-#endif  // USE_NCCL
\ No newline at end of file
+}  // namespace caffe
\ No newline at end of file
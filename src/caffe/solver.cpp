@@ -1,18 +1,57 @@
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
 #include <cstdio>
+#include <cstring>
 
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/solver.hpp"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/quantize.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
 
+namespace {
+
+// A 64-bit FNV-1a hash over the words of the values of blobs, to tell
+// whether a layer changed since the last full snapshot.
+template <typename Dtype>
+uint64_t HashBlobs(const vector<shared_ptr<Blob<Dtype> > >& blobs) {
+  const uint64_t kPrime = 1099511628211ULL;
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < blobs.size(); ++i) {
+    const char* data = reinterpret_cast<const char*>(blobs[i]->cpu_data());
+    const size_t size = blobs[i]->count() * sizeof(Dtype);
+    size_t j = 0;
+    for (; j + sizeof(uint64_t) <= size; j += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, data + j, sizeof(word));
+      hash = (hash ^ word) * kPrime;
+    }
+    uint64_t tail = 0;
+    if (j < size) {
+      memcpy(&tail, data + j, size - j);
+    }
+    hash = (hash ^ tail ^ size) * kPrime;
+  }
+  return hash;
+}
+
+}  // namespace
+
 template<typename Dtype>
 void Solver<Dtype>::SetActionFunction(ActionCallback func) {
   action_request_function_ = func;
@@ -48,6 +87,20 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
   param_ = param;
   CHECK_GE(param_.average_loss(), 1) << "average_loss should be non-negative.";
   CheckSnapshotWritePermissions();
+  if (param_.snapshot_async() && Caffe::root_solver()) {
+    if (param_.snapshot_format() ==
+        caffe::SolverParameter_SnapshotFormat_HDF5) {
+      LOG(WARNING) << "snapshot_async does not apply to HDF5 snapshots, "
+          << "which are written synchronously.";
+    } else {
+      snapshot_writer_.reset(new SnapshotWriter());
+    }
+  }
+  if (param_.snapshot_delta() && param_.snapshot_format() ==
+      caffe::SolverParameter_SnapshotFormat_HDF5) {
+    LOG(WARNING) << "snapshot_delta does not apply to HDF5 snapshots, "
+        << "which are always written in full.";
+  }
   if (param_.random_seed() >= 0) {
     Caffe::set_random_seed(param_.random_seed() + Caffe::solver_rank());
   }
@@ -308,7 +361,12 @@ void Solver<Dtype>::Solve(const char* resume_file) {
       && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
     Snapshot();
   }
+  if (snapshot_writer_) {
+    snapshot_writer_->Wait();
+  }
   if (requested_early_exit_) {
+    // Drop the test in progress, if any.
+    test_thread_.reset();
     LOG(INFO) << "Optimization stopped early.";
     return;
   }
@@ -330,11 +388,75 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
     TestAll();
   }
+  if (test_thread_) {
+    test_thread_->Wait();
+  }
   LOG(INFO) << "Optimization Done.";
 }
 
+template <typename Dtype>
+class Solver<Dtype>::TestThread : public InternalThread {
+ public:
+  explicit TestThread(Solver<Dtype>* solver)
+      : solver_(solver), pending_(false) {
+    StartInternalThread();
+  }
+  virtual ~TestThread() { StopInternalThread(); }
+
+  // Once done with the previous test, copies the weights of the train net
+  // to the test nets and tests them in the background.
+  void Test() {
+    Wait();
+    for (int i = 0; i < solver_->test_nets_.size(); ++i) {
+      solver_->test_nets_[i]->CopyTrainedLayersFrom(solver_->net_.get());
+    }
+    queued_.push(solver_->iter_);
+    pending_ = true;
+  }
+  // Blocks until the test in progress, if any, is done.
+  void Wait() {
+    if (pending_) {
+      done_.pop("Waiting for the previous test to finish");
+      pending_ = false;
+    }
+  }
+
+ protected:
+  virtual void InternalThreadEntry() {
+#ifdef _OPENMP
+    omp_set_num_threads(solver_->param_.test_async_threads());
+#endif
+    try {
+      while (!must_stop()) {
+        const int iter = queued_.pop();
+        for (int i = 0; i < solver_->test_nets_.size(); ++i) {
+          LOG(INFO) << "Iteration " << iter
+                    << ", Testing net (#" << i << ") in the background";
+          solver_->TestNet(i, true);
+        }
+        done_.push(iter);
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  Solver<Dtype>* solver_;
+  // Iterations whose weights are to be tested, and tested.
+  BlockingQueue<int> queued_;
+  BlockingQueue<int> done_;
+  bool pending_;
+};
+
 template <typename Dtype>
 void Solver<Dtype>::TestAll() {
+  if (param_.test_async()) {
+    if (!test_thread_) {
+      test_thread_.reset(new TestThread(this));
+    }
+    test_thread_->Test();
+    return;
+  }
   for (int test_net_id = 0;
        test_net_id < test_nets_.size() && !requested_early_exit_;
        ++test_net_id) {
@@ -349,24 +471,34 @@ void Solver<Dtype>::Test(const int test_net_id) {
             << ", Testing net (#" << test_net_id << ")";
   CHECK_NOTNULL(test_nets_[test_net_id].get())->
       ShareTrainedLayersWith(net_.get());
+  TestNet(test_net_id, false);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::TestNet(const int test_net_id, const bool background) {
   vector<Dtype> test_score;
   vector<int> test_score_output_id;
   const shared_ptr<Net<Dtype> >& test_net = test_nets_[test_net_id];
   Dtype loss = 0;
   for (int i = 0; i < param_.test_iter(test_net_id); ++i) {
-    SolverAction::Enum request = GetRequestedAction();
-    // Check to see if stoppage of testing/training has been requested.
-    while (request != SolverAction::NONE) {
-        if (SolverAction::SNAPSHOT == request) {
-          Snapshot();
-        } else if (SolverAction::STOP == request) {
-          requested_early_exit_ = true;
-        }
-        request = GetRequestedAction();
-    }
-    if (requested_early_exit_) {
-      // break out of test loop.
-      break;
+    if (background) {
+      // Stops here when the test thread is asked to.
+      boost::this_thread::interruption_point();
+    } else {
+      SolverAction::Enum request = GetRequestedAction();
+      // Check to see if stoppage of testing/training has been requested.
+      while (request != SolverAction::NONE) {
+          if (SolverAction::SNAPSHOT == request) {
+            Snapshot();
+          } else if (SolverAction::STOP == request) {
+            requested_early_exit_ = true;
+          }
+          request = GetRequestedAction();
+      }
+      if (requested_early_exit_) {
+        // break out of test loop.
+        break;
+      }
     }
 
     Dtype iter_loss;
@@ -393,7 +525,7 @@ void Solver<Dtype>::Test(const int test_net_id) {
       }
     }
   }
-  if (requested_early_exit_) {
+  if (!background && requested_early_exit_) {
     LOG(INFO)     << "Test interrupted.";
     return;
   }
@@ -420,9 +552,14 @@ void Solver<Dtype>::Test(const int test_net_id) {
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
   CHECK(Caffe::root_solver());
+  if (snapshot_writer_) {
+    // Keep at most one snapshot staged in memory.
+    snapshot_writer_->Wait();
+  }
   string model_filename;
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
+  case caffe::SolverParameter_SnapshotFormat_COMPRESSED:
     model_filename = SnapshotToBinaryProto();
     break;
   case caffe::SolverParameter_SnapshotFormat_HDF5:
@@ -463,12 +600,75 @@ template <typename Dtype>
 string Solver<Dtype>::SnapshotToBinaryProto() {
   string model_filename = SnapshotFilename(".caffemodel");
   LOG(INFO) << "Snapshotting to binary proto file " << model_filename;
-  NetParameter net_param;
-  net_->ToProto(&net_param, param_.snapshot_diff());
-  WriteProtoToBinaryFile(net_param, model_filename);
+  shared_ptr<NetParameter> net_param(new NetParameter());
+  if (param_.snapshot_delta()) {
+    SnapshotDeltaToProto(model_filename, net_param.get());
+  } else {
+    net_->ToProto(net_param.get(), param_.snapshot_diff());
+  }
+  if (param_.snapshot_format() ==
+      caffe::SolverParameter_SnapshotFormat_COMPRESSED &&
+      param_.snapshot_weights_error() > 0) {
+    for (int i = 0; i < net_param->layer_size(); ++i) {
+      LayerParameter* layer_param = net_param->mutable_layer(i);
+      for (int j = 0; j < layer_param->blobs_size(); ++j) {
+        QuantizeBlobProto(param_.snapshot_weights_error(),
+            layer_param->mutable_blobs(j));
+      }
+    }
+  }
+  WriteSnapshotProto(net_param, model_filename);
   return model_filename;
 }
 
+template <typename Dtype>
+void Solver<Dtype>::SnapshotDeltaToProto(const string& model_filename,
+    NetParameter* net_param) {
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net_->layers();
+  vector<uint64_t> hashes(layers.size());
+  vector<int> changed_layers;
+  size_t changed_count = 0;
+  size_t total_count = 0;
+  for (int i = 0; i < layers.size(); ++i) {
+    hashes[i] = HashBlobs(layers[i]->blobs());
+    size_t count = 0;
+    for (int j = 0; j < layers[i]->blobs().size(); ++j) {
+      count += layers[i]->blobs()[j]->count();
+    }
+    total_count += count;
+    if (snapshot_base_.empty() || hashes[i] != snapshot_base_hashes_[i]) {
+      changed_layers.push_back(i);
+      changed_count += count;
+    }
+  }
+  if (snapshot_base_.empty() || 2 * changed_count > total_count) {
+    net_->ToProto(net_param, param_.snapshot_diff());
+    snapshot_base_ = model_filename;
+    snapshot_base_hashes_ = hashes;
+    return;
+  }
+  LOG(INFO) << "Snapshotting " << changed_layers.size() << " of "
+      << layers.size() << " layers as a delta of " << snapshot_base_;
+  net_param->set_name(net_->name());
+  net_param->set_base_weights(
+      boost::filesystem::path(snapshot_base_).filename().string());
+  for (int i = 0; i < changed_layers.size(); ++i) {
+    layers[changed_layers[i]]->ToProto(net_param->add_layer(),
+        param_.snapshot_diff());
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WriteSnapshotProto(
+    const shared_ptr<google::protobuf::Message>& proto,
+    const string& filename) {
+  if (snapshot_writer_) {
+    snapshot_writer_->Write(proto, filename);
+  } else {
+    WriteProtoToBinaryFile(*proto, filename);
+  }
+}
+
 template <typename Dtype>
 string Solver<Dtype>::SnapshotToHDF5() {
   string model_filename = SnapshotFilename(".caffemodel.h5");
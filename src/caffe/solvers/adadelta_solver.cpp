@@ -107,6 +107,36 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaDeltaSolver<Dtype>::ComputeFusedUpdate(int param_id, Dtype rate,
+    int begin, int end) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  Dtype diff_scale, l2_decay, l1_decay;
+  this->GetRegularization(param_id, &diff_scale, &l2_decay, &l1_decay);
+  const Dtype delta = this->param_.delta();
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const size_t update_history_offset = this->net_->learnable_params().size();
+  Dtype* w = param->mutable_cpu_data();
+  Dtype* g = param->mutable_cpu_diff();
+  // histories of gradients and of updates
+  Dtype* h = this->history_[param_id]->mutable_cpu_data();
+  Dtype* h2 =
+      this->history_[update_history_offset + param_id]->mutable_cpu_data();
+#ifdef _OPENMP
+  #pragma omp simd
+#endif
+  for (int i = begin; i < end; ++i) {
+    const Dtype gi = diff_scale * g[i] + l2_decay * w[i] +
+        l1_decay * caffe_sign(w[i]);
+    h[i] = (Dtype(1) - momentum) * gi * gi + momentum * h[i];
+    const Dtype update = gi * std::sqrt((h2[i] + delta) / (h[i] + delta));
+    h2[i] = (Dtype(1) - momentum) * update * update + momentum * h2[i];
+    g[i] = local_rate * update;
+    w[i] -= g[i];
+  }
+}
+
 INSTANTIATE_CLASS(AdaDeltaSolver);
 REGISTER_SOLVER_CLASS(AdaDelta);
 
@@ -89,6 +89,38 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdamSolver<Dtype>::ComputeFusedUpdate(int param_id, Dtype rate,
+    int begin, int end) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  Dtype diff_scale, l2_decay, l1_decay;
+  this->GetRegularization(param_id, &diff_scale, &l2_decay, &l1_decay);
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype beta1 = this->param_.momentum();
+  const Dtype beta2 = this->param_.momentum2();
+  const size_t update_history_offset = this->net_->learnable_params().size();
+  const int t = this->iter_ + 1;
+  const Dtype correction = std::sqrt(Dtype(1) - pow(beta2, t)) /
+      (Dtype(1.) - pow(beta1, t));
+  const Dtype eps_hat = this->param_.delta();
+  Dtype* w = param->mutable_cpu_data();
+  Dtype* g = param->mutable_cpu_diff();
+  Dtype* m = this->history_[param_id]->mutable_cpu_data();
+  Dtype* v =
+      this->history_[update_history_offset + param_id]->mutable_cpu_data();
+#ifdef _OPENMP
+  #pragma omp simd
+#endif
+  for (int i = begin; i < end; ++i) {
+    const Dtype gi = diff_scale * g[i] + l2_decay * w[i] +
+        l1_decay * caffe_sign(w[i]);
+    m[i] = (Dtype(1) - beta1) * gi + beta1 * m[i];
+    v[i] = (Dtype(1) - beta2) * gi * gi + beta2 * v[i];
+    g[i] = local_rate * correction * m[i] / (std::sqrt(v[i]) + eps_hat);
+    w[i] -= g[i];
+  }
+}
+
 INSTANTIATE_CLASS(AdamSolver);
 REGISTER_SOLVER_CLASS(Adam);
 
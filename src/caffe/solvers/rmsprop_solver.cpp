@@ -64,6 +64,30 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void RMSPropSolver<Dtype>::ComputeFusedUpdate(int param_id, Dtype rate,
+    int begin, int end) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  Dtype diff_scale, l2_decay, l1_decay;
+  this->GetRegularization(param_id, &diff_scale, &l2_decay, &l1_decay);
+  const Dtype delta = this->param_.delta();
+  const Dtype rms_decay = this->param_.rms_decay();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  Dtype* w = param->mutable_cpu_data();
+  Dtype* g = param->mutable_cpu_diff();
+  Dtype* h = this->history_[param_id]->mutable_cpu_data();
+#ifdef _OPENMP
+  #pragma omp simd
+#endif
+  for (int i = begin; i < end; ++i) {
+    const Dtype gi = diff_scale * g[i] + l2_decay * w[i] +
+        l1_decay * caffe_sign(w[i]);
+    h[i] = (Dtype(1) - rms_decay) * gi * gi + rms_decay * h[i];
+    g[i] = local_rate * gi / (std::sqrt(h[i]) + delta);
+    w[i] -= g[i];
+  }
+}
+
 INSTANTIATE_CLASS(RMSPropSolver);
 REGISTER_SOLVER_CLASS(RMSProp);
 
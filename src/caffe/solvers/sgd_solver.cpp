@@ -1,9 +1,16 @@
+#include <boost/thread.hpp>
+
+#include <algorithm>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "caffe/internal_thread.hpp"
 #include "caffe/sgd_solvers.hpp"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/quantize.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -69,6 +76,126 @@ Dtype SGDSolver<Dtype>::GetLearningRate() {
   return rate;
 }
 
+/**
+ * Updates the params of each layer on an internal thread as soon as the
+ * after_backward callback of the lowest layer using them has run, so that
+ * the update overlaps with the backward pass of the layers below. Params
+ * shared between layers thereby wait for the last of their users. on_start
+ * arms it for every iteration it can handle, and ApplyUpdate then waits for
+ * the updates instead of computing them.
+ */
+template <typename Dtype>
+class SGDSolver<Dtype>::EagerUpdater : public Solver<Dtype>::Callback,
+    public Net<Dtype>::Callback, public InternalThread {
+ public:
+  explicit EagerUpdater(SGDSolver<Dtype>* solver)
+      : solver_(solver), armed_(false), warned_(false), rate_(), count_() {
+    const Net<Dtype>& net = *solver->net();
+    vector<int> lowest_layer(net.learnable_params().size(),
+        net.layers().size());
+    for (int i = 0; i < net.params().size(); ++i) {
+      const int param_id = net.learnable_param_ids()[i];
+      lowest_layer[param_id] = std::min(lowest_layer[param_id],
+          net.param_layer_indices()[i].first);
+    }
+    layer_params_.resize(net.layers().size());
+    for (int param_id = 0; param_id < lowest_layer.size(); ++param_id) {
+      layer_params_[lowest_layer[param_id]].push_back(param_id);
+    }
+    solver->add_callback(this);
+    solver->net()->add_after_backward(this);
+  }
+  // The net may outlive the solver.
+  virtual ~EagerUpdater() {
+    StopInternalThread();
+    solver_->net()->remove_after_backward(this);
+  }
+
+  bool armed() const { return armed_; }
+  int count() const { return count_; }
+  // Waits for the updates of the iteration and returns their learning rate.
+  Dtype Finish() {
+    ready_.push(-1);
+    done_.pop();
+    armed_ = false;
+    ++count_;
+    return rate_;
+  }
+
+ protected:
+  virtual void on_start() {
+    armed_ = CanRun();
+    if (armed_) {
+      if (!is_started()) {
+        StartInternalThread();
+      }
+      rate_ = solver_->GetLearningRate();
+    }
+  }
+  virtual void on_gradients_ready() {}
+  virtual void run(int layer) {
+    if (armed_ && !layer_params_[layer].empty()) {
+      ready_.push(layer);
+    }
+  }
+
+  virtual void InternalThreadEntry() {
+    try {
+      while (!must_stop()) {
+        const int layer = ready_.pop();
+        if (layer < 0) {
+          done_.push(layer);
+        } else {
+          solver_->ApplyFusedUpdate(rate_, layer_params_[layer]);
+        }
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  // The gradients have to be final after a single backward pass, and
+  // nothing but the update may touch them or the weights in the meantime.
+  bool CanRun() {
+    const SolverParameter& param = solver_->param();
+    string reason;
+    if (Caffe::mode() != Caffe::CPU) {
+      reason = "only CPU training is supported";
+    } else if (!solver_->has_fused_update()) {
+      reason = "the solver has no fused update";
+    } else if (param.iter_size() > 1) {
+      reason = "gradients are accumulated over iter_size passes";
+    } else if (param.clip_gradients() >= 0) {
+      reason = "gradient clipping needs all the gradients";
+    } else if (param.debug_info()) {
+      reason = "debug_info reads the params after the backward pass";
+    } else if (solver_->callbacks().size() > 1) {
+      reason = "another solver callback handles the gradients";
+    }
+    if (!reason.empty() && !warned_) {
+      LOG(WARNING) << "Not updating eagerly: " << reason;
+      warned_ = true;
+    }
+    return reason.empty();
+  }
+
+  SGDSolver<Dtype>* solver_;
+  // The learnable params final after the backward pass of each layer.
+  vector<vector<int> > layer_params_;
+  // Layers whose params are ready, and -1 once the backward pass is over.
+  BlockingQueue<int> ready_;
+  BlockingQueue<int> done_;
+  bool armed_;
+  bool warned_;
+  Dtype rate_;
+  int count_;
+};
+
+template <typename Dtype>
+int SGDSolver<Dtype>::eager_updates() const {
+  return eager_updater_ ? eager_updater_->count() : 0;
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::PreSolve() {
   // Initialize the history
@@ -82,6 +209,9 @@ void SGDSolver<Dtype>::PreSolve() {
     update_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
     temp_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
   }
+  if (this->param_.eager_update()) {
+    eager_updater_.reset(new EagerUpdater(this));
+  }
 }
 
 template <typename Dtype>
@@ -107,25 +237,92 @@ void SGDSolver<Dtype>::ClipGradients() {
 
 template <typename Dtype>
 void SGDSolver<Dtype>::ApplyUpdate() {
-  Dtype rate = GetLearningRate();
+  // Params updated eagerly during the backward pass are only waited for.
+  const bool eager = eager_updater_ && eager_updater_->armed();
+  Dtype rate = eager ? eager_updater_->Finish() : GetLearningRate();
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << this->iter_
         << ", lr = " << rate;
   }
-  ClipGradients();
-  for (int param_id = 0; param_id < this->net_->learnable_params().size();
-       ++param_id) {
-    Normalize(param_id);
-    Regularize(param_id);
-    ComputeUpdateValue(param_id, rate);
+  if (!eager) {
+    ClipGradients();
+    const int param_count = this->net_->learnable_params().size();
+    if (Caffe::mode() == Caffe::CPU && has_fused_update()) {
+      vector<int> param_ids(param_count);
+      for (int param_id = 0; param_id < param_count; ++param_id) {
+        param_ids[param_id] = param_id;
+      }
+      ApplyFusedUpdate(rate, param_ids);
+    } else {
+      for (int param_id = 0; param_id < param_count; ++param_id) {
+        Normalize(param_id);
+        Regularize(param_id);
+        ComputeUpdateValue(param_id, rate);
+      }
+      this->net_->Update();
+    }
   }
-  this->net_->Update();
 
   // Increment the internal iter_ counter -- its value should always indicate
   // the number of times the weights have been updated.
   ++this->iter_;
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplyFusedUpdate(Dtype rate,
+    const vector<int>& param_ids) {
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  // Params are cut into blocks, so that threads stay evenly busy whatever
+  // the sizes of the params. Everything the kernels touch is brought to the
+  // CPU first, so they run on the memory in place.
+  const int kBlockSize = 1 << 16;
+  vector<std::pair<int, int> > blocks;
+  for (int i = 0; i < param_ids.size(); ++i) {
+    const int param_id = param_ids[i];
+    net_params[param_id]->mutable_cpu_data();
+    net_params[param_id]->mutable_cpu_diff();
+    // AdaDelta and Adam keep a second history per param after the first.
+    for (int j = param_id; j < history_.size(); j += net_params.size()) {
+      history_[j]->mutable_cpu_data();
+    }
+    for (int begin = 0; begin < net_params[param_id]->count();
+         begin += kBlockSize) {
+      blocks.push_back(std::make_pair(param_id, begin));
+    }
+  }
+  const int block_count = blocks.size();
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < block_count; ++i) {
+    const int param_id = blocks[i].first;
+    const int begin = blocks[i].second;
+    ComputeFusedUpdate(param_id, rate, begin,
+        std::min(begin + kBlockSize, net_params[param_id]->count()));
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::GetRegularization(int param_id, Dtype* diff_scale,
+    Dtype* l2_decay, Dtype* l1_decay) {
+  // Scale gradient to counterbalance accumulation.
+  *diff_scale = Dtype(1.) / this->param_.iter_size();
+  *l2_decay = 0;
+  *l1_decay = 0;
+  const Dtype local_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  if (local_decay) {
+    const string& regularization_type = this->param_.regularization_type();
+    if (regularization_type == "L2") {
+      *l2_decay = local_decay;
+    } else if (regularization_type == "L1") {
+      *l1_decay = local_decay;
+    } else {
+      LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+    }
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
   if (this->param_.iter_size() == 1) { return; }
@@ -253,10 +450,34 @@ void SGDSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeFusedUpdate(int param_id, Dtype rate,
+    int begin, int end) {
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  Dtype diff_scale, l2_decay, l1_decay;
+  GetRegularization(param_id, &diff_scale, &l2_decay, &l1_decay);
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  Dtype* w = param->mutable_cpu_data();
+  Dtype* g = param->mutable_cpu_diff();
+  Dtype* h = history_[param_id]->mutable_cpu_data();
+#ifdef _OPENMP
+  #pragma omp simd
+#endif
+  for (int i = begin; i < end; ++i) {
+    const Dtype gi = diff_scale * g[i] + l2_decay * w[i] +
+        l1_decay * caffe_sign(w[i]);
+    h[i] = local_rate * gi + momentum * h[i];
+    g[i] = h[i];
+    w[i] -= h[i];
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
   switch (this->param_.snapshot_format()) {
     case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
+    case caffe::SolverParameter_SnapshotFormat_COMPRESSED:
       SnapshotSolverStateToBinaryProto(model_filename);
       break;
     case caffe::SolverParameter_SnapshotFormat_HDF5:
@@ -270,20 +491,26 @@ void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
     const string& model_filename) {
-  SolverState state;
-  state.set_iter(this->iter_);
-  state.set_learned_net(model_filename);
-  state.set_current_step(this->current_step_);
-  state.clear_history();
+  shared_ptr<SolverState> state(new SolverState());
+  state->set_iter(this->iter_);
+  state->set_learned_net(model_filename);
+  state->set_current_step(this->current_step_);
+  state->clear_history();
+  const bool compress = this->param_.snapshot_format() ==
+      caffe::SolverParameter_SnapshotFormat_COMPRESSED &&
+      this->param_.snapshot_history_error() > 0;
   for (int i = 0; i < history_.size(); ++i) {
     // Add history
-    BlobProto* history_blob = state.add_history();
+    BlobProto* history_blob = state->add_history();
     history_[i]->ToProto(history_blob);
+    if (compress) {
+      QuantizeBlobProto(this->param_.snapshot_history_error(), history_blob);
+    }
   }
   string snapshot_filename = Solver<Dtype>::SnapshotFilename(".solverstate");
   LOG(INFO)
     << "Snapshotting solver state to binary proto file " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  this->WriteSnapshotProto(state, snapshot_filename);
 }
 
 template <typename Dtype>
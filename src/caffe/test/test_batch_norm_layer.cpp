@@ -9,6 +9,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/batch_norm_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -121,6 +122,80 @@ namespace caffe {
     }
   }
 
+  TYPED_TEST(BatchNormLayerTest, TestForwardLargeMean) {
+    typedef typename TypeParam::Dtype Dtype;
+    // A large common offset must not degrade the variance estimate.
+    caffe_add_scalar(this->blob_bottom_->count(), Dtype(1000),
+        this->blob_bottom_->mutable_cpu_data());
+    LayerParameter layer_param;
+
+    BatchNormLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+    int num = this->blob_bottom_->num();
+    int channels = this->blob_bottom_->channels();
+    int dim = this->blob_bottom_->height() * this->blob_bottom_->width();
+
+    for (int j = 0; j < channels; ++j) {
+      Dtype sum = 0, var = 0;
+      for (int i = 0; i < num; ++i) {
+        const Dtype* data = this->blob_top_->cpu_data() +
+            this->blob_top_->offset(i, j);
+        for (int k = 0; k < dim; ++k) {
+          sum += data[k];
+          var += data[k] * data[k];
+        }
+      }
+      sum /= dim * num;
+      var /= dim * num;
+
+      const Dtype kErrorBound = 0.005;
+      EXPECT_NEAR(0, sum, kErrorBound);
+      EXPECT_NEAR(1, var, kErrorBound);
+    }
+  }
+
+  TYPED_TEST(BatchNormLayerTest, TestBackwardInplace) {
+    typedef typename TypeParam::Dtype Dtype;
+    const int count = this->blob_bottom_->count();
+    Blob<Dtype> top_diff;
+    top_diff.ReshapeLike(*this->blob_bottom_);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&top_diff);
+    vector<bool> propagate_down(1, true);
+    LayerParameter layer_param;
+
+    // Out of place.
+    BatchNormLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(count, top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+
+    // In place on a copy of the same input.
+    Blob<Dtype> blob_inplace;
+    blob_inplace.CopyFrom(*this->blob_bottom_, false, true);
+    vector<Blob<Dtype>*> blob_inplace_vec(1, &blob_inplace);
+    BatchNormLayer<Dtype> layer_inplace(layer_param);
+    layer_inplace.SetUp(blob_inplace_vec, blob_inplace_vec);
+    layer_inplace.Forward(blob_inplace_vec, blob_inplace_vec);
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+          blob_inplace.cpu_data()[i], 1e-5);
+    }
+    caffe_copy(count, top_diff.cpu_data(), blob_inplace.mutable_cpu_diff());
+    layer_inplace.Backward(blob_inplace_vec, propagate_down,
+        blob_inplace_vec);
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+          blob_inplace.cpu_diff()[i], 1e-4);
+    }
+  }
+
   TYPED_TEST(BatchNormLayerTest, TestGradient) {
     typedef typename TypeParam::Dtype Dtype;
     LayerParameter layer_param;
@@ -1,4 +1,6 @@
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +8,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/quantize.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -113,6 +116,43 @@ TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   EXPECT_FALSE(this->blob_->ShapeEquals(blob_proto));
 }
 
+TYPED_TEST(BlobSimpleTest, TestQuantizedBlobProto) {
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_preshaped_);
+  BlobProto blob_proto;
+  this->blob_preshaped_->ToProto(&blob_proto);
+  const int raw_size = blob_proto.ByteSize();
+  const double kError = 1e-3;
+  QuantizeBlobProto(kError, &blob_proto);
+  ASSERT_TRUE(blob_proto.has_quantized_data());
+  EXPECT_EQ(0, blob_proto.data_size());
+  EXPECT_EQ(0, blob_proto.double_data_size());
+  EXPECT_LT(blob_proto.ByteSize(), raw_size / 2);
+  this->blob_->FromProto(blob_proto);
+  ASSERT_TRUE(this->blob_->ShapeEquals(blob_proto));
+  const TypeParam* data = this->blob_preshaped_->cpu_data();
+  TypeParam max_abs = 0;
+  for (int i = 0; i < this->blob_preshaped_->count(); ++i) {
+    max_abs = std::max(max_abs, std::fabs(data[i]));
+  }
+  for (int i = 0; i < this->blob_->count(); ++i) {
+    EXPECT_NEAR(data[i], this->blob_->cpu_data()[i], kError * max_abs * 1.001);
+  }
+  // An all-zero blob takes a byte per block and comes back exactly.
+  caffe_set(this->blob_preshaped_->count(), TypeParam(0),
+      this->blob_preshaped_->mutable_cpu_data());
+  this->blob_preshaped_->ToProto(&blob_proto);
+  QuantizeBlobProto(kError, &blob_proto);
+  ASSERT_TRUE(blob_proto.has_quantized_data());
+  EXPECT_EQ(2, blob_proto.quantized_data().codes().size());
+  this->blob_->FromProto(blob_proto);
+  for (int i = 0; i < this->blob_->count(); ++i) {
+    EXPECT_EQ(0, this->blob_->cpu_data()[i]);
+  }
+}
+
 template <typename TypeParam>
 class BlobMathTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -707,6 +707,54 @@ TYPED_TEST(ConvolutionLayerTest, TestNDAgainst2D) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestBlockedBackwardAgainstND) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough spatially that the 2D backward-data pass folds col_buffer_
+  // into the bottom diff one input channel at a time.
+  Blob<Dtype> bottom(2, 4, 66, 66);
+  Blob<Dtype> top;
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  vector<Blob<Dtype>*> top_vec(1, &top);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->set_bias_term(false);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  vector<bool> propagate_down(1, true);
+  Blob<Dtype> top_diff;
+  Blob<Dtype> weights;
+  Blob<Dtype> backward_result_2d;
+  {
+    ConvolutionLayer<Dtype> layer_2d(layer_param);
+    layer_2d.SetUp(bottom_vec, top_vec);
+    weights.CopyFrom(*layer_2d.blobs()[0], false, true);
+    top_diff.ReshapeLike(top);
+    filler.Fill(&top_diff);
+    layer_2d.Forward(bottom_vec, top_vec);
+    caffe_copy(top.count(), top_diff.cpu_data(), top.mutable_cpu_diff());
+    layer_2d.Backward(top_vec, propagate_down, bottom_vec);
+    backward_result_2d.CopyFrom(bottom, true, true);
+  }
+  {
+    convolution_param->set_force_nd_im2col(true);
+    ConvolutionLayer<Dtype> layer_nd(layer_param);
+    layer_nd.SetUp(bottom_vec, top_vec);
+    layer_nd.blobs()[0]->CopyFrom(weights, false, false);
+    layer_nd.Forward(bottom_vec, top_vec);
+    caffe_copy(top.count(), top_diff.cpu_data(), top.mutable_cpu_diff());
+    layer_nd.Backward(top_vec, propagate_down, bottom_vec);
+  }
+  for (int i = 0; i < bottom.count(); ++i) {
+    EXPECT_FLOAT_EQ(backward_result_2d.cpu_diff()[i], bottom.cpu_diff()[i]);
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -1,5 +1,6 @@
 
 #ifdef USE_OPENCV
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -68,12 +69,14 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int num_workers = 1, int cache_size_mb = 0) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(5);
+    data_param->set_num_workers(num_workers);
+    data_param->set_cache_size_mb(cache_size_mb);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
 
@@ -132,6 +135,112 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     Caffe::set_solver_rank(0);
   }
 
+  void TestSharded(int num_workers) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    const int batch_size = 3;
+    const int records = 5;
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_num_workers(num_workers);
+    data_param->set_sharded(true);
+    Caffe::set_solver_count(2);
+    const int shard_count = Caffe::solver_count() * num_workers;
+    for (int rank = 0; rank < Caffe::solver_count(); ++rank) {
+      Caffe::set_solver_rank(rank);
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      vector<int> position(num_workers, 0);
+      for (int iter = 0; iter < 4; ++iter) {
+        layer.Forward(blob_bottom_vec_, blob_top_vec_);
+        // Worker w fills a fixed range of each batch from its own shard.
+        for (int w = 0; w < num_workers; ++w) {
+          const int shard = rank * num_workers + w;
+          const int begin = records * shard / shard_count;
+          const int end = records * (shard + 1) / shard_count;
+          for (int i = batch_size * w / num_workers;
+               i < batch_size * (w + 1) / num_workers; ++i) {
+            EXPECT_EQ(begin + position[w], blob_top_label_->cpu_data()[i])
+                << "debug: rank " << rank << " iter " << iter << " i " << i;
+            position[w] = (position[w] + 1) % (end - begin);
+          }
+        }
+      }
+    }
+    Caffe::set_solver_count(1);
+    Caffe::set_solver_rank(0);
+  }
+
+  void TestShuffle() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle(true);
+    Caffe::set_random_seed(seed_);
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    // Every epoch is a permutation of the records, and not always the same.
+    vector<int> first_epoch;
+    bool reordered = false;
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      vector<int> epoch;
+      for (int i = 0; i < 5; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24]);
+        epoch.push_back(label);
+      }
+      if (iter == 0) {
+        first_epoch = epoch;
+      } else {
+        reordered |= epoch != first_epoch;
+      }
+      std::sort(epoch.begin(), epoch.end());
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, epoch[i]) << "debug: iter " << iter;
+      }
+    }
+    EXPECT_TRUE(reordered);
+  }
+
+  void TestShuffleBuffer() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    const int buffer_size = 3;
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle_buffer(buffer_size);
+    Caffe::set_random_seed(seed_);
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    // The n-th record output was one of the first n + buffer_size read, so
+    // after n outputs no record was output more often than it was read.
+    vector<int> output_count(5, 0);
+    bool reordered = false;
+    int n = 0;
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < 5; ++i, ++n) {
+        const int label = blob_top_label_->cpu_data()[i];
+        EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24]);
+        reordered |= label != n % 5;
+        ++output_count[label];
+        for (int j = 0; j < 5; ++j) {
+          const int read_count = (n + buffer_size - j + 4) / 5;
+          EXPECT_LE(output_count[j], read_count) << "debug: n " << n;
+        }
+      }
+    }
+    EXPECT_TRUE(reordered);
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -251,11 +360,12 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(int num_workers = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(5);
+    data_param->set_num_workers(num_workers);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
 
@@ -383,11 +493,40 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadWorkersLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(3);
+}
+
 TYPED_TEST(DataLayerTest, TestSkipLevelDB) {
   this->Fill(false, DataParameter_DB_LEVELDB);
   this->TestSkip();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCachedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(1, 1);
+  this->TestRead(2, 1);
+}
+
+TYPED_TEST(DataLayerTest, TestShardedLevelDB) {
+  this->Fill(false, DataParameter_DB_LEVELDB);
+  this->TestSharded(1);
+  this->TestSharded(2);
+}
+
+TYPED_TEST(DataLayerTest, TestShuffleLevelDB) {
+  this->Fill(false, DataParameter_DB_LEVELDB);
+  this->TestShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestShuffleBufferLevelDB) {
+  this->Fill(false, DataParameter_DB_LEVELDB);
+  this->TestShuffleBuffer();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -406,6 +545,12 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededWorkersLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -428,11 +573,40 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadWorkersLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(3);
+}
+
 TYPED_TEST(DataLayerTest, TestSkipLMDB) {
   this->Fill(false, DataParameter_DB_LMDB);
   this->TestSkip();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCachedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(1, 1);
+  this->TestRead(2, 1);
+}
+
+TYPED_TEST(DataLayerTest, TestShardedLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestSharded(1);
+  this->TestSharded(2);
+}
+
+TYPED_TEST(DataLayerTest, TestShuffleLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestShuffleBufferLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestShuffleBuffer();
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -451,6 +625,12 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededWorkersLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
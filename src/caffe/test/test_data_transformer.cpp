@@ -341,5 +341,118 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestUint8MatchesFloat) {
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+  const int size = channels * height * width;
+
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int j = 0; j < size; ++j) {
+    blob_mean.add_data(j % 7);
+  }
+  WriteProtoToBinaryFile(blob_mean, mean_file);
+
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  Datum float_datum = datum;
+  float_datum.clear_data();
+  for (int j = 0; j < size; ++j) {
+    float_datum.add_float_data(static_cast<uint8_t>(datum.data()[j]));
+  }
+  // The uint8 row kernels must match the generic float loop for every
+  // combination of crop, mirror and mean.
+  for (int crop_size = 0; crop_size <= 3; crop_size += 3) {
+    for (int mean = 0; mean < 3; ++mean) {
+      TransformationParameter transform_param;
+      transform_param.set_scale(0.5);
+      transform_param.set_mirror(true);
+      transform_param.set_crop_size(crop_size);
+      if (mean == 1) {
+        transform_param.add_mean_value(2);
+      } else if (mean == 2) {
+        transform_param.set_mean_file(mean_file);
+      }
+      const int crop_height = crop_size ? crop_size : height;
+      const int crop_width = crop_size ? crop_size : width;
+      Blob<TypeParam> blob(1, channels, crop_height, crop_width);
+      Blob<TypeParam> float_blob(1, channels, crop_height, crop_width);
+      DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+      DataTransformer<TypeParam> float_transformer(transform_param, TRAIN);
+      Caffe::set_random_seed(this->seed_);
+      transformer.InitRand();
+      Caffe::set_random_seed(this->seed_);
+      float_transformer.InitRand();
+      for (int iter = 0; iter < this->num_iter_; ++iter) {
+        transformer.Transform(datum, &blob);
+        float_transformer.Transform(float_datum, &float_blob);
+        for (int j = 0; j < blob.count(); ++j) {
+          EXPECT_EQ(float_blob.cpu_data()[j], blob.cpu_data()[j])
+              << "debug: crop " << crop_size << " mean " << mean;
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestTransformDatumHeader) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = -2;
+  const int channels = 2;
+  const int height = 4;
+  const int width = 5;
+  transform_param.set_scale(0.5);
+  transform_param.add_mean_value(3);
+  Datum datum;
+  FillDatum(label, channels, height, width, unique_pixels, &datum);
+  string serialized;
+  datum.SerializeToString(&serialized);
+
+  Datum header;
+  const char* data;
+  size_t data_size;
+  ASSERT_TRUE(ParseDatumHeader(serialized.data(), serialized.size(),
+      &header, &data, &data_size));
+  EXPECT_EQ(header.label(), label);
+  EXPECT_EQ(header.channels(), channels);
+  EXPECT_EQ(header.height(), height);
+  EXPECT_EQ(header.width(), width);
+  EXPECT_EQ(header.data().size(), 0);
+  ASSERT_EQ(data_size, datum.data().size());
+  EXPECT_GE(data, serialized.data());
+  EXPECT_LE(data + data_size, serialized.data() + serialized.size());
+
+  Blob<TypeParam> blob(1, channels, height, width);
+  Blob<TypeParam> blob_header(1, channels, height, width);
+  DataTransformer<TypeParam> transformer(transform_param, TEST);
+  transformer.InitRand();
+  transformer.Transform(datum, &blob);
+  transformer.Transform(header, data, &blob_header);
+  for (int j = 0; j < blob.count(); ++j) {
+    EXPECT_EQ(blob.cpu_data()[j], blob_header.cpu_data()[j]);
+  }
+
+  // Encoded and float Datums must be parsed in full.
+  datum.set_encoded(true);
+  datum.SerializeToString(&serialized);
+  EXPECT_FALSE(ParseDatumHeader(serialized.data(), serialized.size(),
+      &header, &data, &data_size));
+  datum.clear_encoded();
+  datum.clear_data();
+  datum.add_float_data(1);
+  datum.SerializeToString(&serialized);
+  EXPECT_FALSE(ParseDatumHeader(serialized.data(), serialized.size(),
+      &header, &data, &data_size));
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <unistd.h>
+
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/datum_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DatumCacheTest : public ::testing::Test {
+ protected:
+  DatumCacheTest() {
+    std::ostringstream name;
+    name << "caffe_test_datum_cache_" << getpid();
+    shared_name_ = name.str();
+  }
+  virtual ~DatumCacheTest() {
+    boost::interprocess::shared_memory_object::remove(shared_name_.c_str());
+  }
+
+  // A 2 x 3 x 4 sample whose pixels are all equal to its label.
+  static void MakeSample(int label, Datum* datum, string* pixels) {
+    datum->set_channels(2);
+    datum->set_height(3);
+    datum->set_width(4);
+    datum->set_label(label);
+    pixels->assign(24, static_cast<char>(label));
+  }
+
+  static void ExpectSample(const DatumCache& cache, const string& key,
+      int label) {
+    Datum datum;
+    const char* pixels = cache.Find(key, &datum);
+    ASSERT_TRUE(pixels != NULL) << "debug: key " << key;
+    EXPECT_EQ(2, datum.channels());
+    EXPECT_EQ(3, datum.height());
+    EXPECT_EQ(4, datum.width());
+    EXPECT_EQ(label, datum.label());
+    EXPECT_FALSE(datum.encoded());
+    for (int i = 0; i < 24; ++i) {
+      EXPECT_EQ(static_cast<char>(label), pixels[i]);
+    }
+  }
+
+  string shared_name_;
+};
+
+TEST_F(DatumCacheTest, TestInsertFind) {
+  DatumCache cache(1 << 16, "");
+  Datum datum;
+  string pixels;
+  for (int i = 0; i < 10; ++i) {
+    std::ostringstream key;
+    key << "key" << i;
+    MakeSample(i, &datum, &pixels);
+    EXPECT_TRUE(cache.Insert(key.str(), datum, pixels.data()));
+  }
+  EXPECT_EQ(10, cache.size());
+  // Keys already cached are left alone.
+  MakeSample(7, &datum, &pixels);
+  EXPECT_FALSE(cache.Insert("key3", datum, pixels.data()));
+  for (int i = 0; i < 10; ++i) {
+    std::ostringstream key;
+    key << "key" << i;
+    ExpectSample(cache, key.str(), i);
+    EXPECT_TRUE(cache.Contains(key.str()));
+  }
+  EXPECT_TRUE(cache.Find("key10", &datum) == NULL);
+  EXPECT_TRUE(cache.Find("key", &datum) == NULL);
+  EXPECT_FALSE(cache.Contains("key10"));
+}
+
+TEST_F(DatumCacheTest, TestFull) {
+  const size_t capacity = 1024;
+  DatumCache cache(capacity, "");
+  Datum datum;
+  string pixels;
+  MakeSample(1, &datum, &pixels);
+  int inserted = 0;
+  for (int i = 0; i < 100; ++i) {
+    std::ostringstream key;
+    key << i;
+    if (cache.Insert(key.str(), datum, pixels.data())) {
+      ++inserted;
+    }
+  }
+  EXPECT_GT(inserted, 0);
+  EXPECT_LT(inserted, 100);
+  EXPECT_EQ(inserted, cache.size());
+  EXPECT_LE(cache.bytes(), capacity);
+  // The samples cached before the cache filled up stay available.
+  for (int i = 0; i < inserted; ++i) {
+    std::ostringstream key;
+    key << i;
+    ExpectSample(cache, key.str(), 1);
+  }
+}
+
+TEST_F(DatumCacheTest, TestShared) {
+  DatumCache cache(1 << 16, shared_name_);
+  Datum datum;
+  string pixels;
+  MakeSample(3, &datum, &pixels);
+  EXPECT_TRUE(cache.Insert("a", datum, pixels.data()));
+  // A second cache of the same name sees the samples of the first, and the
+  // other way around, whatever capacity it asks for.
+  DatumCache other(1 << 10, shared_name_);
+  EXPECT_EQ(1 << 16, other.capacity());
+  ExpectSample(other, "a", 3);
+  MakeSample(5, &datum, &pixels);
+  EXPECT_TRUE(other.Insert("b", datum, pixels.data()));
+  ExpectSample(cache, "b", 5);
+  EXPECT_EQ(2, cache.size());
+  // A private cache does not.
+  DatumCache private_cache(1 << 16, "");
+  EXPECT_TRUE(private_cache.Find("a", &datum) == NULL);
+}
+
+}  // namespace caffe
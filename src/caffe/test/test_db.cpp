@@ -118,6 +118,40 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestSeek) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  cursor->Seek("fish-bike.jpg");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  cursor->Seek("d");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  cursor->Seek("cat");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  cursor->Seek("g");
+  EXPECT_FALSE(cursor->valid());
+}
+
+TYPED_TEST(DBTest, TestSeekToOffset) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_EQ(cursor->count(), 2);
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  cursor->SeekToOffset(1);
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  cursor->SeekToOffset(0);
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  cursor->SeekToOffset(2);
+  EXPECT_FALSE(cursor->valid());
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <string>
 #include <utility>
 #include <vector>
@@ -8,6 +9,7 @@
 #include "gtest/gtest.h"
 
 #include "caffe/common.hpp"
+#include "caffe/filler.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/sgd_solvers.hpp"
@@ -26,7 +28,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), eager_update_(false), snapshot_async_(false),
+      snapshot_compressed_(false), gradient_compression_(false) {
         input_file_ = new string(
         ABS_TEST_DATA_DIR "/solver_data_list.txt");
       }
@@ -36,6 +39,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 
   string snapshot_prefix_;
   shared_ptr<SGDSolver<Dtype> > solver_;
+  shared_ptr<SharedMemoryAllReduce<Dtype> > allreduce_;
 #ifdef USE_NCCL
   shared_ptr<NCCL<Dtype> > nccl_;
 #endif
@@ -44,6 +48,10 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool eager_update_;
+  bool snapshot_async_;
+  bool snapshot_compressed_;
+  bool gradient_compression_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -88,6 +96,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "iter_size: " << iter_size << " "
        "device_id: " << device_id << " "
        "layer_wise_reduce: " << (!share_) << " "
+       "eager_update: " << eager_update_ << " "
+       "snapshot_async: " << snapshot_async_ << " "
+       // Tight enough for the updates to match the exact ones.
+       "gradient_compression_error: " << (gradient_compression_ ? 1e-7 : 0)
+       << " "
        "net_param { "
        "  name: 'TestNetwork' "
        "  layer { "
@@ -184,6 +197,11 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (snapshot) {
       proto << "snapshot: " << num_iters << " ";
     }
+    if (snapshot_compressed_) {
+      proto << "snapshot_format: COMPRESSED "
+               "snapshot_history_error: 1e-4 "
+               "snapshot_weights_error: 1e-6 ";
+    }
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
     if (from_snapshot) {
@@ -194,6 +212,12 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-CPU test on " << devices << " workers";
+      Caffe::set_solver_count(devices);
+      this->allreduce_.reset(new SharedMemoryAllReduce<Dtype>(this->solver_));
+      this->allreduce_->Run(from_snapshot);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO) << "Multi-GPU test on " << devices << " devices";
       vector<int> gpus;
@@ -466,6 +490,10 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       CUDA_CHECK(cudaGetDeviceCount(&available_devices));
     }
 #endif
+    if (Caffe::mode() == Caffe::CPU) {
+      // CPU workers run on threads.
+      available_devices = 3;
+    }
     // Takes a while to test all sizes for each test so sparse
     vector<int> sizes;
     sizes.push_back(1);
@@ -507,6 +535,27 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Expects a blob resumed from a snapshot to match the blob trained without
+  // interruption, which it only does approximately for COMPRESSED snapshots.
+  void ExpectResumedEq(const Blob<Dtype>& expected, const Blob<Dtype>& actual,
+      const string& name) {
+    for (int diff = 0; diff <= 1; ++diff) {
+      const Dtype* expected_vec = diff ? expected.cpu_diff() :
+          expected.cpu_data();
+      const Dtype* actual_vec = diff ? actual.cpu_diff() : actual.cpu_data();
+      for (int j = 0; j < expected.count(); ++j) {
+        if (snapshot_compressed_) {
+          EXPECT_NEAR(expected_vec[j], actual_vec[j],
+              1e-3 * std::max(Dtype(1), Dtype(fabs(expected_vec[j]))))
+              << name << (diff ? " diff" : " data") << " differed at dim " << j;
+        } else {
+          EXPECT_FLOAT_EQ(expected_vec[j], actual_vec[j])
+              << name << (diff ? " diff" : " data") << " differed at dim " << j;
+        }
+      }
+    }
+  }
+
   void TestSnapshot(const Dtype learning_rate = 1.0,
       const Dtype weight_decay = 0.0, const Dtype momentum = 0.0,
       const int num_iters = 1) {
@@ -557,27 +606,17 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     // Check that params now match.
     const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
     for (int i = 0; i < params.size(); ++i) {
-      for (int j = 0; j < params[i]->count(); ++j) {
-        EXPECT_FLOAT_EQ(param_copies[i]->cpu_data()[j],
-            params[i]->cpu_data()[j])
-            << "param " << i << " data differed at dim " << j;
-        EXPECT_FLOAT_EQ(param_copies[i]->cpu_diff()[j],
-            params[i]->cpu_diff()[j])
-            << "param " << i << " diff differed at dim " << j;
-      }
+      ostringstream name;
+      name << "param " << i;
+      ExpectResumedEq(*param_copies[i], *params[i], name.str());
     }
 
     // Check that history now matches.
     const vector<shared_ptr<Blob<Dtype> > >& history = solver_->history();
     for (int i = 0; i < history.size(); ++i) {
-      for (int j = 0; j < history[i]->count(); ++j) {
-        EXPECT_FLOAT_EQ(history_copies[i]->cpu_data()[j],
-            history[i]->cpu_data()[j])
-            << "history blob " << i << " data differed at dim " << j;
-        EXPECT_FLOAT_EQ(history_copies[i]->cpu_diff()[j],
-            history[i]->cpu_diff()[j])
-            << "history blob " << i << " diff differed at dim " << j;
-      }
+      ostringstream name;
+      name << "history blob " << i;
+      ExpectResumedEq(*history_copies[i], *history[i], name.str());
     }
   }
 };
@@ -672,6 +711,157 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingEager) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->eager_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+  // A single CPU solver really updates eagerly, rather than falling back.
+  if (Caffe::mode() == Caffe::CPU) {
+    this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+        kNumIters);
+    EXPECT_EQ(kNumIters, this->solver_->eager_updates());
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingEagerShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->share_ = true;
+  this->eager_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingCompressed) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->gradient_compression_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest,
+    TestLeastSquaresUpdateWithEverythingCompressedShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->share_ = true;
+  this->gradient_compression_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+// Exposes the compressed reduction of a single worker.
+template <typename Dtype>
+class CompressedAllReduce : public SharedMemoryAllReduce<Dtype> {
+ public:
+  explicit CompressedAllReduce(shared_ptr<Solver<Dtype> > solver)
+      : SharedMemoryAllReduce<Dtype>(solver) {}
+  void Exchange() { this->ReduceBucket(0); }
+  const vector<Dtype>& residual() const { return this->residual_; }
+};
+
+TYPED_TEST(SGDSolverTest, TestGradientCompressionErrorFeedback) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG(ERROR) << "Skipping test: gradient compression is CPU only.";
+    return;
+  }
+  const double kError = 1e-2;
+  const int kNumIters = 10;
+  ostringstream proto;
+  proto <<
+     "base_lr: 0.01 "
+     "lr_policy: 'fixed' "
+     "layer_wise_reduce: false "
+     "gradient_compression_error: " << kError << " "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      shape { dim: 5 dim: 30 } "
+     "      shape { dim: 5 dim: 10 } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'targets' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    inner_product_param { num_output: 10 } "
+     "    bottom: 'data' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'EuclideanLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'targets' "
+     "  } "
+     "} ";
+  this->InitSolverFromProtoString(proto.str());
+  CompressedAllReduce<Dtype> allreduce(this->solver_);
+  const int count = allreduce.size();
+  Blob<Dtype> gradient(vector<int>(1, count));
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  vector<Dtype> total(count, 0);
+  vector<Dtype> applied_total(count, 0);
+  Dtype largest = 0;
+  int left_out = 0;
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    filler.Fill(&gradient);
+    const Dtype* g = gradient.cpu_data();
+    // Each exchange sends the gradient plus what the previous ones left out.
+    vector<Dtype> expected(count);
+    Dtype iter_largest = 0;
+    for (int i = 0; i < count; ++i) {
+      expected[i] = g[i] + allreduce.residual()[i];
+      iter_largest = std::max(iter_largest, std::fabs(expected[i]));
+      total[i] += g[i];
+    }
+    largest = std::max(largest, iter_largest);
+    caffe_copy(count, g, allreduce.diff());
+    allreduce.Exchange();
+    const Dtype* applied = allreduce.diff();
+    for (int i = 0; i < count; ++i) {
+      EXPECT_LE(std::fabs(applied[i] - expected[i]),
+          kError * iter_largest * 1.001);
+      EXPECT_NEAR(expected[i] - applied[i], allreduce.residual()[i],
+          1e-5 * iter_largest);
+      left_out += allreduce.residual()[i] != 0;
+      applied_total[i] += applied[i];
+    }
+  }
+  EXPECT_GT(left_out, 0);
+  // The applied gradients add up to the exact ones but for what the last
+  // exchange left out, which stays within the bound.
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(applied_total[i] + allreduce.residual()[i], total[i],
+        1e-5 * kNumIters * largest);
+    EXPECT_LE(std::fabs(applied_total[i] - total[i]), kError * largest);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -706,6 +896,30 @@ TYPED_TEST(SGDSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_async_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestSnapshotCompressed) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_compressed_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1137,6 +1351,24 @@ TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingShare) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingEager) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->eager_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+  // A single CPU solver really updates eagerly, rather than falling back.
+  if (Caffe::mode() == Caffe::CPU) {
+    this->RunLeastSquaresSolver(kLearningRate, kWeightDecay, kMomentum,
+        kNumIters);
+    EXPECT_EQ(kNumIters, this->solver_->eager_updates());
+  }
+}
+
 TYPED_TEST(AdamSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
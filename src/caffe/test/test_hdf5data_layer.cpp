@@ -134,6 +134,103 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  param.add_top("label2");
+
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  // Chunks of 3, 3, 3 and 1 rows of each 10-row file.
+  hdf5_data_param->set_chunk_size(3);
+
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), batch_size);
+  EXPECT_EQ(this->blob_top_data_->channels(), 8);
+  EXPECT_EQ(this->blob_top_data_->height(), 6);
+  EXPECT_EQ(this->blob_top_data_->width(), 5);
+
+  // Go through both files twice, as in TestRead.
+  const int data_size = 8 * 6 * 5;
+  for (int iter = 0; iter < 8; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    int file_offset = (iter % 4 < 2) ? 0 : 2400;
+    for (int i = 0; i < batch_size; ++i) {
+      int row = (iter % 2) * batch_size + i;
+      EXPECT_EQ(1 + row, this->blob_top_label_->cpu_data()[i]);
+      EXPECT_EQ(2 + row, this->blob_top_label2_->cpu_data()[i]);
+      for (int j = 0; j < data_size; ++j) {
+        EXPECT_EQ(file_offset + row * data_size + j,
+            this->blob_top_data_->cpu_data()[i * data_size + j])
+            << "debug: i " << i << " j " << j << " iter " << iter;
+      }
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestShuffleChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_chunk_size(batch_size);
+  hdf5_data_param->set_shuffle(true);
+
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Every batch holds the rows of one chunk, in some order.
+  for (int iter = 0; iter < 8; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    vector<bool> seen(batch_size, false);
+    for (int i = 0; i < batch_size; ++i) {
+      int row = this->blob_top_label_->cpu_data()[i] - 1;
+      EXPECT_EQ(iter % 2, row / batch_size);
+      EXPECT_FALSE(seen[row % batch_size]);
+      seen[row % batch_size] = true;
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestShuffleSeeded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_chunk_size(batch_size);
+  hdf5_data_param->set_shuffle(true);
+
+  // The file order, reshuffled by the reader thread at every pass, and the
+  // row order follow the random seed.
+  vector<vector<Dtype> > batches(2);
+  for (int run = 0; run < 2; ++run) {
+    Caffe::set_random_seed(1701);
+    HDF5DataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int iter = 0; iter < 40; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      const Dtype* data = this->blob_top_data_->cpu_data();
+      batches[run].insert(batches[run].end(), data,
+          data + this->blob_top_data_->count());
+    }
+  }
+  EXPECT_TRUE(batches[0] == batches[1]);
+}
+
 TYPED_TEST(HDF5DataLayerTest, TestSkip) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
@@ -216,5 +216,51 @@ TYPED_TEST(ImageDataLayerTest, TestSpace) {
   EXPECT_EQ(this->blob_top_label_->cpu_data()[0], 1);
 }
 
+TYPED_TEST(ImageDataLayerTest, TestDecodeThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(3);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_new_height(64);
+  image_data_param->set_new_width(64);
+  image_data_param->set_shuffle(true);
+  // Batches straddle epochs, so their labels depend on the reshuffling.
+  vector<Dtype> labels, data;
+  Caffe::set_random_seed(this->seed_);
+  {
+    ImageDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < 3; ++i) {
+        labels.push_back(this->blob_top_label_->cpu_data()[i]);
+      }
+      data.insert(data.end(), this->blob_top_data_->cpu_data(),
+          this->blob_top_data_->cpu_data() + this->blob_top_data_->count());
+    }
+  }
+  // Decoding ahead on several threads yields the same batches.
+  image_data_param->set_decode_threads(3);
+  image_data_param->set_decode_queue_size(2);
+  Caffe::set_random_seed(this->seed_);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int iter = 0; iter < 4; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(this->blob_top_data_->num(), 3);
+    EXPECT_EQ(this->blob_top_data_->channels(), 3);
+    EXPECT_EQ(this->blob_top_data_->height(), 64);
+    EXPECT_EQ(this->blob_top_data_->width(), 64);
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_EQ(labels[iter * 3 + i], this->blob_top_label_->cpu_data()[i]);
+    }
+    const int count = this->blob_top_data_->count();
+    for (int i = 0; i < count; ++i) {
+      EXPECT_EQ(data[iter * count + i], this->blob_top_data_->cpu_data()[i]);
+    }
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
\ No newline at end of file
@@ -1,4 +1,6 @@
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +8,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layers/dropout_layer.hpp"
 #include "caffe/layers/inner_product_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -41,6 +44,76 @@ class InnerProductLayerTest : public MultiDeviceTest<TypeParam> {
   Blob<Dtype>* const blob_top_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
+
+  // Checks input_dropout_ratio against a Dropout layer followed by an
+  // InnerProduct layer on blob_bottom_.
+  void TestInputDropout(const bool transpose) {
+    LayerParameter layer_param;
+    layer_param.set_phase(TRAIN);
+    layer_param.mutable_dropout_param()->set_dropout_ratio(0.5);
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    inner_product_param->set_transpose(transpose);
+    Blob<Dtype> bottom;
+    bottom.CopyFrom(*this->blob_bottom_, false, true);
+    vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+    Blob<Dtype> input;
+    input.CopyFrom(*this->blob_bottom_, false, true);
+    InnerProductLayer<Dtype> ip(layer_param);
+    ip.SetUp(bottom_vec, this->blob_top_vec_);
+    DropoutLayer<Dtype> dropout(layer_param);
+    dropout.SetUp(bottom_vec, bottom_vec);
+    Caffe::set_random_seed(1701);
+    dropout.Forward(bottom_vec, bottom_vec);
+    ip.Forward(bottom_vec, this->blob_top_vec_);
+    Blob<Dtype> top;
+    top.CopyFrom(*this->blob_top_, false, true);
+    FillerParameter filler_param;
+    UniformFiller<Dtype> filler(filler_param);
+    Blob<Dtype> top_diff;
+    top_diff.ReshapeLike(*this->blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    ip.Backward(this->blob_top_vec_, propagate_down, bottom_vec);
+    dropout.Backward(bottom_vec, propagate_down, bottom_vec);
+
+    inner_product_param->set_input_dropout_ratio(0.5);
+    InnerProductLayer<Dtype> fused(layer_param);
+    this->blob_bottom_vec_.push_back(this->blob_bottom_);
+    fused.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(ip.blobs()[0]->count(), ip.blobs()[0]->cpu_data(),
+        fused.blobs()[0]->mutable_cpu_data());
+    caffe_copy(ip.blobs()[1]->count(), ip.blobs()[1]->cpu_data(),
+        fused.blobs()[1]->mutable_cpu_data());
+    Caffe::set_random_seed(1701);
+    fused.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < top.count(); ++i) {
+      EXPECT_NEAR(top.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          1e-4 * std::max(Dtype(1), std::fabs(top.cpu_data()[i])));
+    }
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    fused.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+    int dropped = 0;
+    for (int i = 0; i < bottom.count(); ++i) {
+      // The fused layer leaves its input untouched.
+      EXPECT_EQ(input.cpu_data()[i], this->blob_bottom_->cpu_data()[i]);
+      EXPECT_NEAR(bottom.cpu_diff()[i], this->blob_bottom_->cpu_diff()[i],
+          1e-4);
+      dropped += bottom.cpu_data()[i] == 0;
+    }
+    EXPECT_GT(dropped, 0);
+    EXPECT_LT(dropped, bottom.count());
+    for (int i = 0; i < ip.blobs()[0]->count(); ++i) {
+      EXPECT_NEAR(ip.blobs()[0]->cpu_diff()[i],
+          fused.blobs()[0]->cpu_diff()[i], 1e-4);
+    }
+  }
 };
 
 TYPED_TEST_CASE(InnerProductLayerTest, TestDtypesAndDevices);
@@ -389,4 +462,43 @@ TYPED_TEST(InnerProductLayerTest, TestBackwardTranspose) {
   }
 }
 
-}  // namespace caffe
\ No newline at end of file
+// Fused input dropout must match an in-place Dropout layer followed by a
+// plain InnerProduct layer that draw the same mask.
+TYPED_TEST(InnerProductLayerTest, TestInputDropoutMatchesDropoutLayer) {
+  if (Caffe::mode() == Caffe::GPU) {
+    // The GPU Dropout layer draws its mask with cuRAND.
+    LOG(ERROR) << "Skipping test: fused input dropout is CPU only.";
+    return;
+  }
+  this->TestInputDropout(false);
+}
+
+TYPED_TEST(InnerProductLayerTest, TestInputDropoutBlocks) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::GPU) {
+    LOG(ERROR) << "Skipping test: fused input dropout is CPU only.";
+    return;
+  }
+  // Rows this long are masked in blocks of one (double) or two (float) rows,
+  // whose boundaries fall inside the four-element RNG draws.
+  this->blob_bottom_->Reshape(3, 100003, 1, 1);
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->TestInputDropout(false);
+}
+
+TYPED_TEST(InnerProductLayerTest, TestInputDropoutBlocksTranspose) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::GPU) {
+    LOG(ERROR) << "Skipping test: fused input dropout is CPU only.";
+    return;
+  }
+  this->blob_bottom_->Reshape(3, 100003, 1, 1);
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->TestInputDropout(true);
+}
+
+}  // namespace caffe
@@ -201,6 +201,54 @@ TYPED_TEST(LRNLayerTest, TestGradientAcrossChannelsLargeRegion) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(LRNLayerTest, TestGradientAcrossChannelsRecomputeScale) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_lrn_param()->set_recompute_scale(true);
+  LRNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+// Enough channels and pixels that each image is split into several spatial
+// tiles, the last one partial.
+TYPED_TEST(LRNLayerTest, TestAcrossChannelsTiled) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 130, 11, 13);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  LRNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_reference;
+  this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+      &top_reference);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i],
+                this->epsilon_);
+  }
+  caffe_rng_gaussian(this->blob_top_->count(), Dtype(0), Dtype(1),
+      this->blob_top_->mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  Blob<Dtype> bottom_diff_stored;
+  bottom_diff_stored.CopyFrom(*this->blob_bottom_, true, true);
+  // Recomputing the scale in Backward must give the same gradient.
+  layer_param.mutable_lrn_param()->set_recompute_scale(true);
+  LRNLayer<Dtype> recompute_layer(layer_param);
+  recompute_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  recompute_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  recompute_layer.Backward(this->blob_top_vec_, propagate_down,
+      this->blob_bottom_vec_);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+        bottom_diff_stored.cpu_diff()[i], this->epsilon_);
+  }
+}
+
 TYPED_TEST(LRNLayerTest, TestSetupWithinChannel) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
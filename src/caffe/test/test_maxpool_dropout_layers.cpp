@@ -122,7 +122,14 @@ TYPED_TEST(MaxPoolingDropoutTest, TestBackward) {
   for (int i = 0; i < this->blob_bottom_->count(); ++i) {
     sum_with_dropout += bottom_diff[i];
   }
-  EXPECT_GE(sum_with_dropout, sum);
+  // The input is all ones, so each kept output holds the dropout scale and
+  // passes exactly that much gradient back through its max location.
+  Dtype sum_kept = 0.;
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    sum_kept += this->blob_top_->cpu_data()[i];
+  }
+  EXPECT_GT(sum_kept, 0);
+  EXPECT_EQ(sum_with_dropout, sum_kept);
 }
 
 }  // namespace caffe
\ No newline at end of file
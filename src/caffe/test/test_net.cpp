@@ -10,8 +10,10 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/parallel.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/weights_file.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -1343,6 +1345,78 @@ TYPED_TEST(NetTest, TestSharedWeightsResume) {
   }
 }
 
+TYPED_TEST(NetTest, TestWeightsFileResume) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  // Create a net with weight sharing; Update it once.
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->ForwardBackward();
+  this->net_->Update();
+  vector<shared_ptr<Blob<Dtype> > > params;
+  for (int i = 0; i < this->net_->params().size(); ++i) {
+    params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    params[i]->CopyFrom(*this->net_->params()[i], false, true);
+  }
+
+  // Convert the net to a weights file, as convert_weights does.
+  NetParameter net_param;
+  this->net_->ToProto(&net_param);
+  string filename;
+  MakeTempFilename(&filename);
+  WriteWeightsFile(net_param, filename);
+  EXPECT_TRUE(WeightsFile::IsWeightsFile(filename));
+
+  // Reinitialize the net and load the weights file.
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->CopyTrainedLayersFrom(filename);
+  ASSERT_EQ(params.size(), this->net_->params().size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>& param = *this->net_->params()[i];
+    ASSERT_EQ(params[i]->shape(), param.shape());
+    for (int j = 0; j < param.count(); ++j) {
+      EXPECT_EQ(params[i]->cpu_data()[j], param.cpu_data()[j]);
+    }
+  }
+  // The weights are shared as before.
+  EXPECT_EQ(this->net_->layers()[1]->blobs()[0]->cpu_data(),
+            this->net_->layers()[2]->blobs()[0]->cpu_data());
+}
+
+TYPED_TEST(NetTest, TestReduceBuckets) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTrickyNet();
+  // Layer 1 holds 24000 + 1000 params and layer 2 holds 1 + 1 after them.
+  ReduceBuckets<Dtype> per_layer(*this->net_, 0);
+  ASSERT_EQ(2, per_layer.size());
+  EXPECT_EQ(-1, per_layer.ready(0));
+  EXPECT_EQ(1, per_layer.ready(1));
+  EXPECT_EQ(0, per_layer.ready(2));
+  EXPECT_EQ(-1, per_layer.ready(3));
+  EXPECT_EQ(25000, per_layer.begin(0));
+  EXPECT_EQ(25002, per_layer.end(0));
+  EXPECT_EQ(0, per_layer.begin(1));
+  EXPECT_EQ(25000, per_layer.end(1));
+  // Small layers are fused with the ones below them.
+  ReduceBuckets<Dtype> fused(*this->net_, 4 * sizeof(Dtype));
+  ASSERT_EQ(1, fused.size());
+  EXPECT_EQ(-1, fused.ready(2));
+  EXPECT_EQ(0, fused.ready(1));
+  EXPECT_EQ(0, fused.begin(0));
+  EXPECT_EQ(25002, fused.end(0));
+
+  // Shared weights are final once their owner, the lowest layer using
+  // them, has run backward. Layer 1 splits the data for layers 2 and 3.
+  this->InitSharedWeightsNet();
+  ReduceBuckets<Dtype> shared(*this->net_, 0);
+  ASSERT_EQ(1, shared.size());
+  EXPECT_EQ(0, shared.ready(2));
+  EXPECT_EQ(-1, shared.ready(3));
+  EXPECT_EQ(0, shared.begin(0));
+  EXPECT_EQ(240, shared.end(0));
+}
+
 TYPED_TEST(NetTest, TestParamPropagateDown) {
   typedef typename TypeParam::Dtype Dtype;
   const bool kBiasTerm = true, kForceBackward = false;
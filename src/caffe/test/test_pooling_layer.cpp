@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -609,6 +612,88 @@ TYPED_TEST(PoolingLayerTest, TestGradientAvePadded) {
   }
 }
 
+// The 2x2 and 3x3 stride-2 windows take a specialized interior loop; check
+// it against a direct evaluation, including clipped and padded borders and
+// ties (which must resolve to the first maximum in scan order).
+TYPED_TEST(PoolingLayerTest, TestForwardStride2MatchesReference) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 3, 13, 11);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Dtype* bottom_data = this->blob_bottom_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    bottom_data[i] = floor(bottom_data[i] * 2);
+  }
+  this->blob_top_vec_.push_back(this->blob_top_mask_);
+  const int height = this->blob_bottom_->height();
+  const int width = this->blob_bottom_->width();
+  for (int kernel = 2; kernel <= 3; ++kernel) {
+    for (int pad = 0; pad < kernel; ++pad) {
+      for (int method = 0; method < 2; ++method) {
+        const bool is_max = method == 0;
+        LayerParameter layer_param;
+        PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+        pooling_param->set_kernel_size(kernel);
+        pooling_param->set_stride(2);
+        pooling_param->set_pad(pad);
+        pooling_param->set_pool(is_max ? PoolingParameter_PoolMethod_MAX :
+            PoolingParameter_PoolMethod_AVE);
+        if (!is_max) {
+          this->blob_top_vec_.pop_back();
+        }
+        PoolingLayer<Dtype> layer(layer_param);
+        layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+        layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+        const int pooled_height = this->blob_top_->height();
+        const int pooled_width = this->blob_top_->width();
+        for (int n = 0; n < this->blob_top_->num(); ++n) {
+          for (int c = 0; c < this->blob_top_->channels(); ++c) {
+            const Dtype* bottom = this->blob_bottom_->cpu_data() +
+                this->blob_bottom_->offset(n, c);
+            for (int ph = 0; ph < pooled_height; ++ph) {
+              for (int pw = 0; pw < pooled_width; ++pw) {
+                int hstart = ph * 2 - pad;
+                int wstart = pw * 2 - pad;
+                int hend = std::min(hstart + kernel, height + pad);
+                int wend = std::min(wstart + kernel, width + pad);
+                const int pool_size = (hend - hstart) * (wend - wstart);
+                hstart = std::max(hstart, 0);
+                wstart = std::max(wstart, 0);
+                hend = std::min(hend, height);
+                wend = std::min(wend, width);
+                Dtype maxval = -FLT_MAX;
+                int maxidx = -1;
+                Dtype sum = 0;
+                for (int h = hstart; h < hend; ++h) {
+                  for (int w = wstart; w < wend; ++w) {
+                    if (bottom[h * width + w] > maxval) {
+                      maxval = bottom[h * width + w];
+                      maxidx = h * width + w;
+                    }
+                    sum += bottom[h * width + w];
+                  }
+                }
+                const int index = this->blob_top_->offset(n, c, ph, pw);
+                if (is_max) {
+                  EXPECT_EQ(this->blob_top_->cpu_data()[index], maxval);
+                  EXPECT_EQ(this->blob_top_mask_->cpu_data()[index], maxidx);
+                } else {
+                  EXPECT_EQ(this->blob_top_->cpu_data()[index],
+                      sum / pool_size);
+                }
+              }
+            }
+          }
+        }
+        if (!is_max) {
+          this->blob_top_vec_.push_back(this->blob_top_mask_);
+        }
+      }
+    }
+  }
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNPoolingLayerTest : public GPUDeviceTest<Dtype> {
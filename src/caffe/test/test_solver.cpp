@@ -10,6 +10,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/sgd_solvers.hpp"
 #include "caffe/solver.hpp"
+#include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -107,4 +108,217 @@ TYPED_TEST(SolverTest, TestInitTrainTestNets) {
   EXPECT_TRUE(this->solver_->test_nets()[1]->has_layer("accuracy"));
 }
 
+TYPED_TEST(SolverTest, TestAsyncTest) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string& proto =
+     "base_lr: 0.01 "
+     "lr_policy: 'fixed' "
+     "max_iter: 4 "
+     "test_interval: 2 "
+     "test_iter: 3 "
+     "test_async: true "
+     "snapshot_after_train: false "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      data_filler { type: 'gaussian' } "
+     "      shape { dim: 5 dim: 24 } "
+     "      shape { dim: 5 dim: 10 } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'target' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    inner_product_param { "
+     "      num_output: 10 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "    bottom: 'data' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'EuclideanLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'target' "
+     "  } "
+     "} ";
+  this->InitSolverFromProtoString(proto);
+  this->solver_->Solve();
+
+  // The test net holds a copy of the final weights rather than sharing the
+  // ones training updates.
+  ASSERT_EQ(1, this->solver_->test_nets().size());
+  const vector<Blob<Dtype>*>& train_params =
+      this->solver_->net()->learnable_params();
+  const vector<Blob<Dtype>*>& test_params =
+      this->solver_->test_nets()[0]->learnable_params();
+  ASSERT_EQ(train_params.size(), test_params.size());
+  for (int i = 0; i < train_params.size(); ++i) {
+    EXPECT_NE(train_params[i]->cpu_data(), test_params[i]->cpu_data());
+    for (int j = 0; j < train_params[i]->count(); ++j) {
+      EXPECT_EQ(train_params[i]->cpu_data()[j], test_params[i]->cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(SolverTest, TestSnapshotDelta) {
+  typedef typename TypeParam::Dtype Dtype;
+  string snapshot_prefix;
+  MakeTempDir(&snapshot_prefix);
+  snapshot_prefix += "/delta";
+  ostringstream proto;
+  proto <<
+     "base_lr: 0.01 "
+     "lr_policy: 'fixed' "
+     "max_iter: 4 "
+     "snapshot: 2 "
+     "snapshot_after_train: false "
+     "snapshot_delta: true "
+     "snapshot_prefix: '" << snapshot_prefix << "' "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      data_filler { type: 'gaussian' } "
+     "      shape { dim: 5 dim: 24 } "
+     "      shape { dim: 5 dim: 10 } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'target' "
+     "  } "
+     "  layer { "
+     "    name: 'frozen' "
+     "    type: 'InnerProduct' "
+     "    param { lr_mult: 0 } "
+     "    param { lr_mult: 0 } "
+     "    inner_product_param { "
+     "      num_output: 20 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "    bottom: 'data' "
+     "    top: 'frozen' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    inner_product_param { "
+     "      num_output: 10 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "    bottom: 'frozen' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'EuclideanLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'target' "
+     "  } "
+     "} ";
+  this->InitSolverFromProtoString(proto.str());
+  this->solver_->Solve();
+
+  // The first snapshot is written in full, the second only holds the layer
+  // that learned since.
+  const string base_filename = snapshot_prefix + "_iter_2.caffemodel";
+  const string delta_filename = snapshot_prefix + "_iter_4.caffemodel";
+  NetParameter base_param;
+  ReadProtoFromBinaryFileOrDie(base_filename, &base_param);
+  EXPECT_FALSE(base_param.has_base_weights());
+  EXPECT_EQ(4, base_param.layer_size());
+  NetParameter delta_param;
+  ReadProtoFromBinaryFileOrDie(delta_filename, &delta_param);
+  EXPECT_EQ("delta_iter_2.caffemodel", delta_param.base_weights());
+  ASSERT_EQ(1, delta_param.layer_size());
+  EXPECT_EQ("innerprod", delta_param.layer(0).name());
+
+  // Loading the delta loads its base first, from the directory of the
+  // delta wherever it was moved to.
+  const path snapshot_dir = path(snapshot_prefix).parent_path();
+  const path moved_dir = snapshot_dir.string() + "_moved";
+  boost::filesystem::rename(snapshot_dir, moved_dir);
+  NetParameter net_param = this->solver_->param().net_param();
+  net_param.mutable_state()->set_phase(TRAIN);
+  Net<Dtype> net(net_param);
+  net.CopyTrainedLayersFrom((moved_dir / "delta_iter_4.caffemodel").string());
+  const vector<Blob<Dtype>*>& expected =
+      this->solver_->net()->learnable_params();
+  const vector<Blob<Dtype>*>& actual = net.learnable_params();
+  ASSERT_EQ(expected.size(), actual.size());
+  for (int i = 0; i < expected.size(); ++i) {
+    for (int j = 0; j < expected[i]->count(); ++j) {
+      EXPECT_EQ(expected[i]->cpu_data()[j], actual[i]->cpu_data()[j])
+          << "param " << i << " value " << j;
+    }
+  }
+}
+
+// Counts the calls of ComputeUpdateValue, which the CPU fused update must
+// not bypass in a subclass.
+template <typename Dtype>
+class CountingSGDSolver : public SGDSolver<Dtype> {
+ public:
+  explicit CountingSGDSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param), update_count_(0) {}
+  int update_count_;
+
+ protected:
+  virtual void ComputeUpdateValue(int param_id, Dtype rate) {
+    ++update_count_;
+    SGDSolver<Dtype>::ComputeUpdateValue(param_id, rate);
+  }
+};
+
+TYPED_TEST(SolverTest, TestSubclassUpdateIsCalled) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string& proto =
+     "base_lr: 0.01 "
+     "lr_policy: 'fixed' "
+     "momentum: 0.9 "
+     "weight_decay: 0.001 "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      data_filler { type: 'gaussian' } "
+     "      shape { dim: 5 dim: 3 } "
+     "      shape { dim: 5 dim: 2 } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'target' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    inner_product_param { "
+     "      num_output: 2 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "    bottom: 'data' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'EuclideanLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'target' "
+     "  } "
+     "} ";
+  this->InitSolverFromProtoString(proto);
+  CountingSGDSolver<Dtype> solver(this->solver_->param());
+  solver.Step(2);
+  // Weights and bias, twice.
+  EXPECT_EQ(4, solver.update_count_);
+}
+
 }  // namespace caffe
\ No newline at end of file
@@ -67,6 +67,44 @@ TYPED_TEST(CPUStochasticPoolingLayerTest, TestSetup) {
   EXPECT_EQ(this->blob_top_->width(), 2);
 }
 
+TYPED_TEST(CPUStochasticPoolingLayerTest, TestStochasticTestPhase) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  // The weighted average can never exceed the window maximum
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int n = 0; n < this->blob_top_->num(); ++n) {
+    for (int c = 0; c < this->blob_top_->channels(); ++c) {
+      for (int ph = 0; ph < this->blob_top_->height(); ++ph) {
+        for (int pw = 0; pw < this->blob_top_->width(); ++pw) {
+          Dtype pooled = top_data[this->blob_top_->offset(n, c, ph, pw)];
+          int hstart = ph * 2;
+          int hend = min(hstart + 3, this->blob_bottom_->height());
+          int wstart = pw * 2;
+          int wend = min(wstart + 3, this->blob_bottom_->width());
+          bool smaller_than_max = false;
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              smaller_than_max |= (pooled <= bottom_data[this->blob_bottom_->
+                  offset(n, c, h, w)]);
+            }
+          }
+          EXPECT_TRUE(smaller_than_max);
+        }
+      }
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -3,8 +3,12 @@
 #include <string>
 
 #include "caffe/layers/base_data_layer.hpp"
+#ifdef USE_HDF5
+#include "caffe/layers/hdf5_data_layer.hpp"
+#endif  // USE_HDF5
 #include "caffe/parallel.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/snapshot_writer.hpp"
 
 namespace caffe {
 
@@ -88,5 +92,11 @@ size_t BlockingQueue<T>::size() const {
 
 template class BlockingQueue<Batch<float>*>;
 template class BlockingQueue<Batch<double>*>;
+#ifdef USE_HDF5
+template class BlockingQueue<HDF5Chunk<float>*>;
+template class BlockingQueue<HDF5Chunk<double>*>;
+#endif  // USE_HDF5
+template class BlockingQueue<int>;
+template class BlockingQueue<SnapshotWriter::File*>;
 
 }  // namespace caffe
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#include <boost/interprocess/anonymous_shared_memory.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/thread.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include "caffe/util/datum_cache.hpp"
+
+namespace caffe {
+
+namespace bip = boost::interprocess;
+
+namespace {
+
+// Marks a segment whose creator has finished initializing it.
+const uint64_t kMagic = 0x4361666665444332ULL;
+// Bytes of cache per hash table slot. The table is full at 3/4 of its
+// slots, so samples smaller than about 384 bytes cannot fill the capacity.
+const size_t kBytesPerSlot = 512;
+
+// Only inserters lock the mutex. On Linux it is robust, so that a process
+// killed while inserting does not leave it locked for every later user of
+// the segment.
+struct Header {
+  uint64_t magic;
+  uint64_t capacity;
+  uint64_t slot_count;
+  uint64_t used;
+  uint64_t entries;
+  pthread_mutex_t mutex;
+};
+
+// A shared segment is mapped at a different address in every process, so
+// slots refer to entries by their offset in the arena, plus one so that
+// zero marks an empty slot. An inserter reserves the arena bytes of an
+// entry, writes it, and only then publishes it by storing its slot's entry
+// with release semantics; readers load it with acquire semantics and need
+// no lock. An insert cut short thus wastes arena bytes at worst.
+struct Slot {
+  uint64_t hash;
+  uint64_t entry;
+};
+
+// An entry of the arena, followed by its key and pixels and padded to
+// 8 bytes.
+struct Entry {
+  uint32_t key_size;
+  int32_t channels;
+  int32_t height;
+  int32_t width;
+  int32_t label;
+};
+
+// 64-bit FNV-1a.
+uint64_t HashKey(const string& key) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); ++i) {
+    hash ^= static_cast<unsigned char>(key[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+}  // namespace
+
+class DatumCache::Segment {
+ public:
+  Segment(size_t capacity, const string& shared_name) {
+    uint64_t slot_count = 64;
+    while (slot_count < capacity / kBytesPerSlot) {
+      slot_count *= 2;
+    }
+    const size_t size = sizeof(Header) + slot_count * sizeof(Slot) + capacity;
+    if (shared_name.empty()) {
+      bip::mapped_region region(bip::anonymous_shared_memory(size));
+      region_.swap(region);
+      Initialize(capacity, slot_count);
+      return;
+    }
+    try {
+      bip::shared_memory_object shm(bip::create_only, shared_name.c_str(),
+          bip::read_write);
+      shm.truncate(size);
+      bip::mapped_region region(shm, bip::read_write);
+      region_.swap(region);
+      Initialize(capacity, slot_count);
+      LOG(INFO) << "Created shared data cache " << shared_name;
+    } catch (const bip::interprocess_exception& e) {
+      CHECK_EQ(e.get_error_code(), bip::already_exists_error)
+          << "Cannot create shared data cache " << shared_name << ": "
+          << e.what();
+      Open(shared_name);
+      LOG(INFO) << "Opened shared data cache " << shared_name << " holding "
+          << header_->entries << " samples";
+    }
+  }
+
+  const Entry* entry(uint64_t offset) const {
+    return reinterpret_cast<const Entry*>(arena_ + offset - 1);
+  }
+
+  // Returns the slot holding key, or the empty slot it would go to, and
+  // sets offset to the entry published in it, or 0.
+  Slot* Probe(const string& key, uint64_t hash, uint64_t* offset) const {
+    const uint64_t mask = header_->slot_count - 1;
+    for (uint64_t i = hash & mask; ; i = (i + 1) & mask) {
+      Slot* slot = slots_ + i;
+      *offset = __atomic_load_n(&slot->entry, __ATOMIC_ACQUIRE);
+      if (!*offset) {
+        return slot;
+      }
+      if (slot->hash == hash) {
+        const Entry* e = entry(*offset);
+        if (e->key_size == key.size() &&
+            memcmp(e + 1, key.data(), key.size()) == 0) {
+          return slot;
+        }
+      }
+    }
+  }
+
+  // Locks the inserter mutex, taking it over from a process that died
+  // holding it where mutexes are robust.
+  void Lock() {
+    int ret = pthread_mutex_lock(&header_->mutex);
+#ifdef __linux__
+    if (ret == EOWNERDEAD) {
+      LOG(WARNING) << "A process died while adding to the data cache; "
+          << "taking over its lock.";
+      ret = pthread_mutex_consistent(&header_->mutex);
+    }
+#endif
+    CHECK_EQ(ret, 0) << "Cannot lock the data cache: " << strerror(ret);
+  }
+  void Unlock() {
+    pthread_mutex_unlock(&header_->mutex);
+  }
+
+  Header* header_;
+  Slot* slots_;
+  char* arena_;
+
+ protected:
+  // Mapped pages start out zeroed, so only the header needs initializing.
+  void Initialize(uint64_t capacity, uint64_t slot_count) {
+    header_ = static_cast<Header*>(region_.get_address());
+    header_->capacity = capacity;
+    header_->slot_count = slot_count;
+    header_->used = 0;
+    header_->entries = 0;
+    pthread_mutexattr_t attr;
+    CHECK_EQ(pthread_mutexattr_init(&attr), 0);
+    CHECK_EQ(pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED), 0);
+#ifdef __linux__
+    CHECK_EQ(pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST), 0);
+#endif
+    CHECK_EQ(pthread_mutex_init(&header_->mutex, &attr), 0);
+    pthread_mutexattr_destroy(&attr);
+    *static_cast<volatile uint64_t*>(&header_->magic) = kMagic;
+    Map();
+  }
+
+  // Waits for the creator of the segment to size and initialize it.
+  void Open(const string& shared_name) {
+    bip::shared_memory_object shm(bip::open_only, shared_name.c_str(),
+        bip::read_write);
+    const int kRetries = 1000;
+    bip::offset_t size = 0;
+    for (int i = 0; i < kRetries && (!shm.get_size(size) ||
+         size < static_cast<bip::offset_t>(sizeof(Header))); ++i) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    bip::mapped_region region(shm, bip::read_write);
+    region_.swap(region);
+    header_ = static_cast<Header*>(region_.get_address());
+    for (int i = 0; i < kRetries &&
+         *static_cast<volatile uint64_t*>(&header_->magic) != kMagic; ++i) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    CHECK_EQ(header_->magic, kMagic) << "Shared data cache " << shared_name
+        << " was never initialized; remove it and restart.";
+    Map();
+  }
+
+  void Map() {
+    header_ = static_cast<Header*>(region_.get_address());
+    slots_ = reinterpret_cast<Slot*>(header_ + 1);
+    arena_ = reinterpret_cast<char*>(slots_ + header_->slot_count);
+  }
+
+  bip::mapped_region region_;
+};
+
+DatumCache::DatumCache(size_t capacity, const string& shared_name)
+    : segment_(new Segment(capacity, shared_name)) {
+}
+
+DatumCache::~DatumCache() {
+}
+
+bool DatumCache::Contains(const string& key) const {
+  uint64_t offset;
+  segment_->Probe(key, HashKey(key), &offset);
+  return offset != 0;
+}
+
+const char* DatumCache::Find(const string& key, Datum* datum) const {
+  const uint64_t hash = HashKey(key);
+  uint64_t offset;
+  segment_->Probe(key, hash, &offset);
+  if (!offset) {
+    return NULL;
+  }
+  const Entry* entry = segment_->entry(offset);
+  datum->Clear();
+  datum->set_channels(entry->channels);
+  datum->set_height(entry->height);
+  datum->set_width(entry->width);
+  datum->set_label(entry->label);
+  return reinterpret_cast<const char*>(entry + 1) + entry->key_size;
+}
+
+bool DatumCache::Insert(const string& key, const Datum& datum,
+    const char* pixels) {
+  const size_t pixel_count = static_cast<size_t>(datum.channels()) *
+      datum.height() * datum.width();
+  const size_t entry_size =
+      (sizeof(Entry) + key.size() + pixel_count + 7) & ~static_cast<size_t>(7);
+  const uint64_t hash = HashKey(key);
+  Header* header = segment_->header_;
+  segment_->Lock();
+  uint64_t offset;
+  Slot* slot = segment_->Probe(key, hash, &offset);
+  const uint64_t used = header->used;
+  if (offset || used + entry_size > header->capacity ||
+      (header->entries + 1) * 4 > header->slot_count * 3) {
+    segment_->Unlock();
+    return false;
+  }
+  __atomic_store_n(&header->used, used + entry_size, __ATOMIC_RELEASE);
+  Entry* entry = reinterpret_cast<Entry*>(segment_->arena_ + used);
+  entry->key_size = key.size();
+  entry->channels = datum.channels();
+  entry->height = datum.height();
+  entry->width = datum.width();
+  entry->label = datum.label();
+  char* data = reinterpret_cast<char*>(entry + 1);
+  memcpy(data, key.data(), key.size());
+  memcpy(data + key.size(), pixels, pixel_count);
+  slot->hash = hash;
+  __atomic_store_n(&slot->entry, used + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&header->entries, header->entries + 1, __ATOMIC_RELEASE);
+  segment_->Unlock();
+  return true;
+}
+
+size_t DatumCache::size() const {
+  return __atomic_load_n(&segment_->header_->entries, __ATOMIC_ACQUIRE);
+}
+
+size_t DatumCache::bytes() const {
+  return __atomic_load_n(&segment_->header_->used, __ATOMIC_ACQUIRE);
+}
+
+size_t DatumCache::capacity() const {
+  return segment_->header_->capacity;
+}
+
+}  // namespace caffe
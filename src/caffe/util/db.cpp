@@ -6,6 +6,22 @@
 
 namespace caffe { namespace db {
 
+void Cursor::SeekToOffset(size_t offset) {
+  SeekToFirst();
+  for (size_t i = 0; i < offset && valid(); ++i) {
+    Next();
+  }
+}
+
+size_t Cursor::count() {
+  size_t records = 0;
+  for (SeekToFirst(); valid(); Next()) {
+    ++records;
+  }
+  SeekToFirst();
+  return records;
+}
+
 DB* GetDB(DataParameter::DB backend) {
   switch (backend) {
 #ifdef USE_LEVELDB
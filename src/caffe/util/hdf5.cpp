@@ -6,11 +6,9 @@
 
 namespace caffe {
 
-// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
-template <typename Dtype>
-void hdf5_load_nd_dataset_helper(
-    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
-    Blob<Dtype>* blob, bool reshape) {
+// Verifies format of data stored in HDF5 file and returns its shape.
+vector<int> hdf5_get_dataset_shape(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim) {
   // Verify that the dataset exists.
   CHECK(H5LTfind_dataset(file_id, dataset_name_))
       << "Failed to find HDF5 dataset " << dataset_name_;
@@ -62,7 +60,16 @@ void hdf5_load_nd_dataset_helper(
   for (int i = 0; i < dims.size(); ++i) {
     blob_dims[i] = dims[i];
   }
+  return blob_dims;
+}
 
+// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
+template <typename Dtype>
+void hdf5_load_nd_dataset_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<Dtype>* blob, bool reshape) {
+  vector<int> blob_dims =
+      hdf5_get_dataset_shape(file_id, dataset_name_, min_dim, max_dim);
   if (reshape) {
     blob->Reshape(blob_dims);
   } else {
@@ -104,6 +111,55 @@ void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
 }
 
+// Reads rows [row_begin, row_begin + row_count) of the first axis of a
+// dataset into blob, as a hyperslab converted to mem_type_id.
+template <typename Dtype>
+static void hdf5_load_nd_dataset_rows_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    hsize_t row_begin, hsize_t row_count, hid_t mem_type_id,
+    Blob<Dtype>* blob) {
+  vector<int> blob_dims =
+      hdf5_get_dataset_shape(file_id, dataset_name_, min_dim, max_dim);
+  CHECK_LE(row_begin + row_count, blob_dims[0])
+      << "Cannot load rows " << row_begin << " to " << row_begin + row_count
+      << " of HDF5 dataset " << dataset_name_ << " of " << blob_dims[0]
+      << " rows";
+  blob_dims[0] = row_count;
+  blob->Reshape(blob_dims);
+  std::vector<hsize_t> start(blob_dims.size(), 0);
+  std::vector<hsize_t> count(blob_dims.begin(), blob_dims.end());
+  start[0] = row_begin;
+  hid_t dataset_id = H5Dopen2(file_id, dataset_name_, H5P_DEFAULT);
+  CHECK_GE(dataset_id, 0) << "Failed to open HDF5 dataset " << dataset_name_;
+  hid_t file_space_id = H5Dget_space(dataset_id);
+  herr_t status = H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET,
+      start.data(), NULL, count.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select rows of " << dataset_name_;
+  hid_t mem_space_id = H5Screate_simple(count.size(), count.data(), NULL);
+  status = H5Dread(dataset_id, mem_type_id, mem_space_id, file_space_id,
+      H5P_DEFAULT, blob->mutable_cpu_data());
+  CHECK_GE(status, 0) << "Failed to read rows of dataset " << dataset_name_;
+  H5Sclose(mem_space_id);
+  H5Sclose(file_space_id);
+  H5Dclose(dataset_id);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<float>(hid_t file_id,
+    const char* dataset_name_, int min_dim, int max_dim, hsize_t row_begin,
+    hsize_t row_count, Blob<float>* blob) {
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, min_dim, max_dim,
+      row_begin, row_count, H5T_NATIVE_FLOAT, blob);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<double>(hid_t file_id,
+    const char* dataset_name_, int min_dim, int max_dim, hsize_t row_begin,
+    hsize_t row_count, Blob<double>* blob) {
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, min_dim, max_dim,
+      row_begin, row_count, H5T_NATIVE_DOUBLE, blob);
+}
+
 template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string& dataset_name, const Blob<float>& blob,
@@ -3,6 +3,7 @@
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/wire_format_lite.h>
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -10,6 +11,8 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #endif  // USE_OPENCV
 #include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -28,6 +31,7 @@ using google::protobuf::io::FileInputStream;
 using google::protobuf::io::FileOutputStream;
 using google::protobuf::io::ZeroCopyInputStream;
 using google::protobuf::io::CodedInputStream;
+using google::protobuf::internal::WireFormatLite;
 using google::protobuf::io::ZeroCopyOutputStream;
 using google::protobuf::io::CodedOutputStream;
 using google::protobuf::Message;
@@ -70,6 +74,19 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
+void WriteProtoToBinaryFileAtomically(const Message& proto,
+    const string& filename) {
+  const string temp_filename = filename + ".tmp";
+  int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_NE(fd, -1) << "Couldn't create " << temp_filename;
+  CHECK(proto.SerializeToFileDescriptor(fd))
+      << "Couldn't write " << temp_filename;
+  CHECK_EQ(fsync(fd), 0) << "Couldn't sync " << temp_filename;
+  CHECK_EQ(close(fd), 0) << "Couldn't close " << temp_filename;
+  CHECK_EQ(rename(temp_filename.c_str(), filename.c_str()), 0)
+      << "Couldn't rename " << temp_filename << " to " << filename;
+}
+
 #ifdef USE_OPENCV
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width, const bool is_color) {
@@ -103,6 +120,87 @@ cv::Mat ReadImageToCVMat(const string& filename) {
   return ReadImageToCVMat(filename, 0, 0, true);
 }
 
+// Reduced decoding appeared in OpenCV 3.2; 2.4 defines CV_VERSION_EPOCH
+// and reuses CV_VERSION_MAJOR for its second number.
+#if !defined(CV_VERSION_EPOCH) && (CV_VERSION_MAJOR > 3 || \
+    (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2))
+#define CAFFE_REDUCED_IMREAD
+#endif
+
+#ifdef CAFFE_REDUCED_IMREAD
+// Reads the size of a JPEG from its frame header, without decoding it.
+static bool ReadJPEGSize(const string& filename, int* height, int* width) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  if (file.get() != 0xFF || file.get() != 0xD8) {
+    return false;
+  }
+  while (file.get() == 0xFF) {
+    int marker = file.get();
+    while (marker == 0xFF) {
+      marker = file.get();
+    }
+    unsigned char length[2];
+    if (!file.read(reinterpret_cast<char*>(length), 2)) {
+      return false;
+    }
+    // SOF0 to SOF15, except DHT, JPG and DAC which share their range.
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC) {
+      unsigned char frame[5];
+      if (!file.read(reinterpret_cast<char*>(frame), 5)) {
+        return false;
+      }
+      *height = frame[1] << 8 | frame[2];
+      *width = frame[3] << 8 | frame[4];
+      return *height > 0 && *width > 0;
+    }
+    const int size = length[0] << 8 | length[1];
+    if (marker == 0xDA || size < 2) {
+      return false;
+    }
+    file.seekg(size - 2, std::ios::cur);
+  }
+  return false;
+}
+#endif
+
+cv::Mat ReadImageToCVMatReduced(const string& filename,
+    const int height, const int width, const bool is_color) {
+#ifdef CAFFE_REDUCED_IMREAD
+  int image_height, image_width;
+  if (height > 0 && width > 0 &&
+      ReadJPEGSize(filename, &image_height, &image_width)) {
+    int scale = 8;
+    while (scale > 1 &&
+        (image_height / scale < height || image_width / scale < width)) {
+      scale /= 2;
+    }
+    if (scale > 1) {
+      int cv_read_flag;
+      if (scale == 8) {
+        cv_read_flag = is_color ? cv::IMREAD_REDUCED_COLOR_8 :
+            cv::IMREAD_REDUCED_GRAYSCALE_8;
+      } else if (scale == 4) {
+        cv_read_flag = is_color ? cv::IMREAD_REDUCED_COLOR_4 :
+            cv::IMREAD_REDUCED_GRAYSCALE_4;
+      } else {
+        cv_read_flag = is_color ? cv::IMREAD_REDUCED_COLOR_2 :
+            cv::IMREAD_REDUCED_GRAYSCALE_2;
+      }
+      cv::Mat cv_img_reduced = cv::imread(filename, cv_read_flag);
+      if (!cv_img_reduced.data) {
+        LOG(ERROR) << "Could not open or find file " << filename;
+        return cv_img_reduced;
+      }
+      cv::Mat cv_img;
+      cv::resize(cv_img_reduced, cv_img, cv::Size(width, height));
+      return cv_img;
+    }
+  }
+#endif
+  return ReadImageToCVMat(filename, height, width, is_color);
+}
+
 // Do the file extension and encoding match?
 static bool matchExt(const std::string & fn,
                      std::string en) {
@@ -143,6 +241,61 @@ bool ReadImageToDatum(const string& filename, const int label,
 }
 #endif  // USE_OPENCV
 
+bool ParseDatumHeader(const char* buffer, size_t size, Datum* header,
+    const char** data, size_t* data_size) {
+  header->Clear();
+  *data = NULL;
+  *data_size = 0;
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(buffer), size);
+  uint32_t tag;
+  while ((tag = input.ReadTag()) != 0) {
+    const int field = WireFormatLite::GetTagFieldNumber(tag);
+    const WireFormatLite::WireType wire_type =
+        WireFormatLite::GetTagWireType(tag);
+    uint32_t value;
+    if (field == Datum::kDataFieldNumber &&
+        wire_type == WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      const void* bytes;
+      int available;
+      if (!input.ReadVarint32(&value) ||
+          !input.GetDirectBufferPointer(&bytes, &available) ||
+          static_cast<uint32_t>(available) < value) {
+        return false;
+      }
+      *data = static_cast<const char*>(bytes);
+      *data_size = value;
+      input.Skip(value);
+      continue;
+    }
+    if (wire_type != WireFormatLite::WIRETYPE_VARINT ||
+        !input.ReadVarint32(&value)) {
+      return false;
+    }
+    switch (field) {
+    case Datum::kChannelsFieldNumber:
+      header->set_channels(value);
+      break;
+    case Datum::kHeightFieldNumber:
+      header->set_height(value);
+      break;
+    case Datum::kWidthFieldNumber:
+      header->set_width(value);
+      break;
+    case Datum::kLabelFieldNumber:
+      header->set_label(value);
+      break;
+    case Datum::kEncodedFieldNumber:
+      if (value) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+  return *data != NULL && input.ConsumedEntireMessage();
+}
+
 bool ReadFileToDatum(const string& filename, const int label,
     Datum* datum) {
   std::streampos size;
@@ -2,6 +2,7 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -32,6 +33,24 @@ void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       ldb, beta, C, N);
 }
 
+template<>
+void caffe_cpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float* A, const int lda, const float* B,
+    const int ldb, const float beta, float* C, const int ldc) {
+  cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+      ldb, beta, C, ldc);
+}
+
+template<>
+void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double* A, const int lda, const double* B,
+    const int ldb, const double beta, double* C, const int ldc) {
+  cblas_dgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+      ldb, beta, C, ldc);
+}
+
 template <>
 void caffe_cpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
     const int N, const float alpha, const float* A, const float* x,
@@ -336,6 +355,39 @@ void caffe_rng_bernoulli<double>(const int n, const double p, unsigned int* r);
 template
 void caffe_rng_bernoulli<float>(const int n, const float p, unsigned int* r);
 
+template <typename Dtype>
+void caffe_cpu_dropout(const int n, const unsigned int threshold,
+    const Dtype scale, const uint64_t seed, const Dtype* x, Dtype* y,
+    const int first) {
+  // Every Philox draw covers the four elements of a block.
+  const int first_block = first / 4;
+  const int last_block = (first + n + 3) / 4;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int b = first_block; b < last_block; ++b) {
+    const uint32_t counter[4] = { static_cast<uint32_t>(b), 0, 0, 0 };
+    uint32_t r[4];
+    philox4x32(counter, seed, r);
+    const int begin = std::max(4 * b, first);
+    const int end = std::min(4 * b + 4, first + n);
+    for (int k = begin; k < end; ++k) {
+      const int i = k - first;
+      y[i] = r[k - 4 * b] > threshold ? x[i] * scale : Dtype(0);
+    }
+  }
+}
+
+template
+void caffe_cpu_dropout<float>(const int n, const unsigned int threshold,
+    const float scale, const uint64_t seed, const float* x, float* y,
+    const int first);
+
+template
+void caffe_cpu_dropout<double>(const int n, const unsigned int threshold,
+    const double scale, const uint64_t seed, const double* x, double* y,
+    const int first);
+
 template <>
 float caffe_cpu_strided_dot<float>(const int n, const float* x, const int incx,
     const float* y, const int incy) {
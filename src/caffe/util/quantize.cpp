@@ -0,0 +1,190 @@
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "caffe/util/quantize.hpp"
+
+namespace caffe {
+
+namespace {
+
+const int kBlockSize = 64;
+
+inline uint32_t ZigZag(int32_t code) {
+  return (static_cast<uint32_t>(code) << 1) ^ static_cast<uint32_t>(code >> 31);
+}
+
+inline int32_t UnZigZag(uint32_t zigzag) {
+  return static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+}
+
+inline int BitWidth(uint32_t value) {
+  int width = 0;
+  for (; value; value >>= 1) {
+    ++width;
+  }
+  return width;
+}
+
+// Bytes taken by a block of count codes width bits wide, with its width.
+inline size_t BlockBytes(int count, int width) {
+  return 1 + (static_cast<size_t>(count) * width + 7) / 8;
+}
+
+}  // namespace
+
+template <typename Dtype>
+bool QuantizeData(const Dtype* data, int count, double error,
+    QuantizedData* quantized) {
+  double max_abs = 0;
+  int non_finite = 0;
+#ifdef _OPENMP
+  #pragma omp parallel for reduction(max: max_abs) reduction(+: non_finite)
+#endif
+  for (int i = 0; i < count; ++i) {
+    const double value = data[i];
+    if (!boost::math::isfinite(value)) {
+      ++non_finite;
+    } else if (std::fabs(value) > max_abs) {
+      max_abs = std::fabs(value);
+    }
+  }
+  // Codes have to fit in 31 bits: |code| <= max_abs / step + 1/2.
+  if (non_finite || error <= 0 || 0.5 / error > (1 << 30)) {
+    return false;
+  }
+  const double step = max_abs > 0 ? 2 * error * max_abs : 1;
+  if (step == 0) {
+    return false;
+  }
+  const int block_count = (count + kBlockSize - 1) / kBlockSize;
+  vector<uint8_t> widths(block_count);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int b = 0; b < block_count; ++b) {
+    const int end = std::min(count, (b + 1) * kBlockSize);
+    uint32_t bits = 0;
+    for (int i = b * kBlockSize; i < end; ++i) {
+      bits |= ZigZag(static_cast<int32_t>(std::floor(data[i] / step + 0.5)));
+    }
+    widths[b] = BitWidth(bits);
+  }
+  vector<size_t> offsets(block_count + 1, 0);
+  for (int b = 0; b < block_count; ++b) {
+    offsets[b + 1] = offsets[b] + BlockBytes(
+        std::min(kBlockSize, count - b * kBlockSize), widths[b]);
+  }
+  if (offsets[block_count] >= count * sizeof(Dtype)) {
+    return false;
+  }
+  string* codes = quantized->mutable_codes();
+  codes->resize(offsets[block_count]);
+  uint8_t* out = reinterpret_cast<uint8_t*>(&(*codes)[0]);
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int b = 0; b < block_count; ++b) {
+    const int end = std::min(count, (b + 1) * kBlockSize);
+    const int width = widths[b];
+    uint8_t* block = out + offsets[b];
+    *block++ = width;
+    uint64_t bits = 0;
+    int bit_count = 0;
+    for (int i = b * kBlockSize; i < end; ++i) {
+      bits |= static_cast<uint64_t>(ZigZag(static_cast<int32_t>(
+          std::floor(data[i] / step + 0.5)))) << bit_count;
+      for (bit_count += width; bit_count >= 8; bit_count -= 8) {
+        *block++ = static_cast<uint8_t>(bits);
+        bits >>= 8;
+      }
+    }
+    if (bit_count > 0) {
+      *block = static_cast<uint8_t>(bits);
+    }
+  }
+  quantized->set_step(step);
+  return true;
+}
+
+template bool QuantizeData<float>(const float* data, int count,
+    double error, QuantizedData* quantized);
+template bool QuantizeData<double>(const double* data, int count,
+    double error, QuantizedData* quantized);
+
+void QuantizeBlobProto(double error, BlobProto* proto) {
+  QuantizedData quantized;
+  if (proto->double_data_size() > 0) {
+    if (QuantizeData(proto->double_data().data(), proto->double_data_size(),
+        error, &quantized)) {
+      proto->clear_double_data();
+      proto->mutable_quantized_data()->Swap(&quantized);
+    }
+  } else if (proto->data_size() > 0) {
+    if (QuantizeData(proto->data().data(), proto->data_size(), error,
+        &quantized)) {
+      proto->clear_data();
+      proto->mutable_quantized_data()->Swap(&quantized);
+    }
+  }
+}
+
+template <typename Dtype>
+void DequantizeCodes(const char* codes, size_t size, double step, int count,
+    Dtype* data) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(codes);
+  const int block_count = (count + kBlockSize - 1) / kBlockSize;
+  vector<size_t> offsets(block_count + 1, 0);
+  for (int b = 0; b < block_count; ++b) {
+    CHECK_LT(offsets[b], size) << "Quantized data holds too few values.";
+    CHECK_LE(in[offsets[b]], 32) << "Corrupt quantized data.";
+    offsets[b + 1] = offsets[b] + BlockBytes(
+        std::min(kBlockSize, count - b * kBlockSize), in[offsets[b]]);
+  }
+  CHECK_EQ(offsets[block_count], size)
+      << "Quantized data does not hold " << count << " values.";
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int b = 0; b < block_count; ++b) {
+    const int end = std::min(count, (b + 1) * kBlockSize);
+    const uint8_t* block = in + offsets[b];
+    const int width = *block++;
+    const uint64_t mask = (static_cast<uint64_t>(1) << width) - 1;
+    uint64_t bits = 0;
+    int bit_count = 0;
+    for (int i = b * kBlockSize; i < end; ++i) {
+      for (; bit_count < width; bit_count += 8) {
+        bits |= static_cast<uint64_t>(*block++) << bit_count;
+      }
+      data[i] = UnZigZag(static_cast<uint32_t>(bits & mask)) * step;
+      bits >>= width;
+      bit_count -= width;
+    }
+  }
+}
+
+template <typename Dtype>
+void DequantizeData(const QuantizedData& quantized, int count, Dtype* data) {
+  DequantizeCodes(quantized.codes().data(), quantized.codes().size(),
+      quantized.step(), count, data);
+}
+
+template void DequantizeCodes<float>(const char* codes, size_t size,
+    double step, int count, float* data);
+template void DequantizeCodes<double>(const char* codes, size_t size,
+    double step, int count, double* data);
+template void DequantizeData<int>(const QuantizedData& quantized,
+    int count, int* data);
+template void DequantizeData<unsigned int>(const QuantizedData& quantized,
+    int count, unsigned int* data);
+template void DequantizeData<float>(const QuantizedData& quantized,
+    int count, float* data);
+template void DequantizeData<double>(const QuantizedData& quantized,
+    int count, double* data);
+
+}  // namespace caffe
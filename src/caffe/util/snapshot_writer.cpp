@@ -0,0 +1,50 @@
+#include <boost/thread.hpp>
+
+#include <string>
+
+#include "caffe/util/io.hpp"
+#include "caffe/util/snapshot_writer.hpp"
+
+namespace caffe {
+
+SnapshotWriter::SnapshotWriter()
+    : pending_(0) {
+  StartInternalThread();
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  Wait();
+  StopInternalThread();
+}
+
+void SnapshotWriter::Write(const shared_ptr<google::protobuf::Message>& proto,
+    const string& filename) {
+  File* file = new File();
+  file->proto = proto;
+  file->filename = filename;
+  queued_.push(file);
+  ++pending_;
+}
+
+void SnapshotWriter::Wait() {
+  for (; pending_ > 0; --pending_) {
+    delete written_.pop("Waiting for snapshot to be written");
+  }
+}
+
+void SnapshotWriter::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      File* file = queued_.pop();
+      WriteProtoToBinaryFileAtomically(*file->proto, file->filename);
+      LOG(INFO) << "Wrote snapshot file " << file->filename;
+      // Free the staged copy right away rather than at the next Wait().
+      file->proto.reset();
+      written_.push(file);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+}  // namespace caffe
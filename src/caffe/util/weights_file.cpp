@@ -0,0 +1,192 @@
+#include <stdint.h>
+
+#include <boost/interprocess/exceptions.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/weights_file.hpp"
+
+namespace caffe {
+
+namespace bip = boost::interprocess;
+
+namespace {
+
+const char kMagic[8] = {'C', 'A', 'F', 'F', 'E', 'W', 'T', 'S'};
+
+struct Header {
+  char magic[8];
+  uint32_t element_size;
+  uint32_t index_size;
+};
+
+inline size_t Align(size_t offset) {
+  return (offset + WeightsFile::kAlignment - 1) / WeightsFile::kAlignment
+      * WeightsFile::kAlignment;
+}
+
+// Number of values held by a blob of the given shape.
+size_t BlobCount(const BlobProto& proto) {
+  if (proto.has_num() || proto.has_channels() ||
+      proto.has_height() || proto.has_width()) {
+    return static_cast<size_t>(proto.num()) * proto.channels() *
+        proto.height() * proto.width();
+  }
+  size_t count = 1;
+  for (int i = 0; i < proto.shape().dim_size(); ++i) {
+    count *= proto.shape().dim(i);
+  }
+  return count;
+}
+
+// Copies the count values of proto, however they are stored, to values.
+template <typename Dtype>
+void BlobValues(const BlobProto& proto, size_t count, Dtype* values) {
+  if (proto.double_data_size() > 0) {
+    CHECK_EQ(count, static_cast<size_t>(proto.double_data_size()))
+        << "Blob size mismatch.";
+    std::copy(proto.double_data().begin(), proto.double_data().end(), values);
+  } else if (proto.data_size() > 0) {
+    CHECK_EQ(count, static_cast<size_t>(proto.data_size()))
+        << "Blob size mismatch.";
+    std::copy(proto.data().begin(), proto.data().end(), values);
+  } else if (proto.has_quantized_data()) {
+    DequantizeData(proto.quantized_data(), count, values);
+  } else {
+    CHECK_EQ(count, static_cast<size_t>(0)) << "Blob holds no values.";
+  }
+}
+
+}  // namespace
+
+WeightsFile::WeightsFile(const string& filename) : filename_(filename) {
+  try {
+    bip::file_mapping(filename.c_str(), bip::read_only).swap(file_);
+    bip::mapped_region(file_, bip::read_only).swap(region_);
+  } catch (const bip::interprocess_exception& e) {
+    LOG(FATAL) << "Failed to map " << filename << ": " << e.what();
+  }
+  // The values are read once, front to back.
+  region_.advise(bip::mapped_region::advice_sequential);
+  const char* base = static_cast<const char*>(region_.get_address());
+  const size_t size = region_.get_size();
+  Header header;
+  CHECK_GE(size, sizeof(header)) << "Truncated weights file " << filename;
+  memcpy(&header, base, sizeof(header));
+  CHECK_EQ(memcmp(header.magic, kMagic, sizeof(kMagic)), 0)
+      << filename << " is not a weights file.";
+  element_size_ = header.element_size;
+  CHECK(element_size_ == sizeof(float) || element_size_ == sizeof(double))
+      << "Unsupported element size " << element_size_ << " in " << filename;
+  CHECK_LE(sizeof(header) + header.index_size, size)
+      << "Truncated weights file " << filename;
+  CHECK(index_.ParseFromArray(base + sizeof(header), header.index_size))
+      << "Failed to parse the index of " << filename;
+  size_t offset = sizeof(header) + header.index_size;
+  offsets_.resize(index_.layer_size());
+  counts_.resize(index_.layer_size());
+  for (int i = 0; i < index_.layer_size(); ++i) {
+    for (int j = 0; j < index_.layer(i).blobs_size(); ++j) {
+      offset = Align(offset);
+      offsets_[i].push_back(offset);
+      counts_[i].push_back(BlobCount(index_.layer(i).blobs(j)));
+      offset += counts_[i].back() * element_size_;
+    }
+  }
+  CHECK_LE(offset, size) << "Truncated weights file " << filename;
+}
+
+bool WeightsFile::IsWeightsFile(const string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(kMagic)];
+  return file.read(magic, sizeof(magic)) &&
+      memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+template <typename Dtype>
+void WeightsFile::CopyBlob(int layer_id, int blob_id, Blob<Dtype>* blob) const {
+  const size_t count = counts_[layer_id][blob_id];
+  CHECK_EQ(count, static_cast<size_t>(blob->count())) << "Blob size mismatch.";
+  const char* data = static_cast<const char*>(region_.get_address()) +
+      offsets_[layer_id][blob_id];
+  Dtype* target = blob->mutable_cpu_data();
+  if (element_size_ == sizeof(float)) {
+    const float* source = reinterpret_cast<const float*>(data);
+    std::copy(source, source + count, target);
+  } else {
+    const double* source = reinterpret_cast<const double*>(data);
+    std::copy(source, source + count, target);
+  }
+}
+
+template void WeightsFile::CopyBlob(int layer_id, int blob_id,
+    Blob<float>* blob) const;
+template void WeightsFile::CopyBlob(int layer_id, int blob_id,
+    Blob<double>* blob) const;
+
+void WriteWeightsFile(const NetParameter& param, const string& filename) {
+  NetParameter index;
+  index.set_name(param.name());
+  bool has_double = false;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& source_layer = param.layer(i);
+    LayerParameter* layer = index.add_layer();
+    layer->set_name(source_layer.name());
+    layer->set_type(source_layer.type());
+    for (int j = 0; j < source_layer.blobs_size(); ++j) {
+      const BlobProto& source_blob = source_layer.blobs(j);
+      BlobProto* blob = layer->add_blobs();
+      if (source_blob.has_num() || source_blob.has_channels() ||
+          source_blob.has_height() || source_blob.has_width()) {
+        blob->set_num(source_blob.num());
+        blob->set_channels(source_blob.channels());
+        blob->set_height(source_blob.height());
+        blob->set_width(source_blob.width());
+      } else {
+        blob->mutable_shape()->CopyFrom(source_blob.shape());
+      }
+      has_double |= source_blob.double_data_size() > 0;
+    }
+  }
+  string index_bytes;
+  CHECK(index.SerializeToString(&index_bytes));
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.element_size = has_double ? sizeof(double) : sizeof(float);
+  header.index_size = index_bytes.size();
+
+  std::ofstream file(filename.c_str(),
+      std::ios::out | std::ios::trunc | std::ios::binary);
+  CHECK(file) << "Failed to open " << filename;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(index_bytes.data(), index_bytes.size());
+  size_t offset = sizeof(header) + index_bytes.size();
+  const char padding[WeightsFile::kAlignment] = {};
+  vector<char> values;
+  for (int i = 0; i < index.layer_size(); ++i) {
+    for (int j = 0; j < index.layer(i).blobs_size(); ++j) {
+      file.write(padding, Align(offset) - offset);
+      offset = Align(offset);
+      const size_t count = BlobCount(index.layer(i).blobs(j));
+      values.resize(std::max<size_t>(count * header.element_size, 1));
+      if (has_double) {
+        BlobValues(param.layer(i).blobs(j), count,
+            reinterpret_cast<double*>(&values[0]));
+      } else {
+        BlobValues(param.layer(i).blobs(j), count,
+            reinterpret_cast<float*>(&values[0]));
+      }
+      file.write(&values[0], count * header.element_size);
+      offset += count * header.element_size;
+    }
+  }
+  file.close();
+  CHECK(!file.fail()) << "Failed to write " << filename;
+}
+
+}  // namespace caffe
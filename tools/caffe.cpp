@@ -6,13 +6,23 @@ namespace bp = boost::python;
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/interprocess/shared_memory_object.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/util/signal_handler.h"
 
@@ -31,6 +41,12 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(cpu_workers, 1,
+    "Optional; train on the CPU in this many processes, each with its own "
+    "solver and share of the data, averaging gradients through shared "
+    "memory. The effective training batch size is multiplied by the number "
+    "of workers. Limit the threads of each (e.g. OMP_NUM_THREADS, "
+    "OPENBLAS_NUM_THREADS) so that they do not oversubscribe the cores.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -163,6 +179,99 @@ caffe::SolverAction::Enum GetRequestedAction(
   LOG(FATAL) << "Invalid signal effect \""<< flag_value << "\" was specified";
 }
 
+// Exit status of rank 0 when it stopped before max_iter, which leaves the
+// other CPU workers waiting for it.
+static const int kCPUWorkersStopped = 3;
+// Seconds the other CPU workers get to finish their last iteration once
+// rank 0 is done.
+static const int kCPUWorkersExitTimeout = 60;
+
+static void kill_cpu_workers(const vector<pid_t>& pids) {
+  for (int i = 0; i < pids.size(); ++i) {
+    if (pids[i] > 0) {
+      kill(pids[i], SIGKILL);
+    }
+  }
+}
+
+// Forks FLAGS_cpu_workers processes and returns the solver rank of each in
+// it. The original process stays behind to supervise them: once rank 0 is
+// done it waits for the others to finish, but when rank 0 stopped early or
+// any worker fails, it kills them. It exits with 0, or 1 on failures.
+// Workers die with it.
+static int fork_cpu_workers(const string& shared_name) {
+  const pid_t supervisor = getpid();
+  // Signal effects apply to rank 0, which gets them too.
+  signal(SIGINT, SIG_IGN);
+  signal(SIGHUP, SIG_IGN);
+  vector<pid_t> pids(FLAGS_cpu_workers);
+  for (int rank = 0; rank < pids.size(); ++rank) {
+    pids[rank] = fork();
+    CHECK_GE(pids[rank], 0) << "Cannot fork CPU worker " << rank;
+    if (pids[rank] == 0) {
+#ifdef __linux__
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+      if (getppid() != supervisor) {
+        _exit(1);
+      }
+      signal(SIGINT, SIG_DFL);
+      signal(SIGHUP, SIG_DFL);
+      return rank;
+    }
+  }
+  int exit_code = 0;
+  int running = pids.size();
+  bool stopping = false;
+  // Set while the other workers finish after rank 0.
+  time_t deadline = 0;
+  while (running > 0) {
+    int status;
+    const pid_t pid = waitpid(-1, &status, deadline ? WNOHANG : 0);
+    CHECK_GE(pid, 0) << "Lost track of the CPU workers";
+    if (pid == 0) {
+      if (time(NULL) < deadline) {
+        usleep(100000);
+      } else {
+        LOG(WARNING) << "CPU workers did not finish after rank 0, "
+            << "killing them";
+        stopping = true;
+        deadline = 0;
+        kill_cpu_workers(pids);
+      }
+      continue;
+    }
+    const int rank = std::find(pids.begin(), pids.end(), pid) - pids.begin();
+    if (rank == pids.size()) {
+      continue;
+    }
+    pids[rank] = 0;
+    --running;
+    const bool stopped = rank == 0 && WIFEXITED(status) &&
+        WEXITSTATUS(status) == kCPUWorkersStopped;
+    const bool failed = !stopped &&
+        (!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+    if (stopping) {
+      continue;
+    }
+    if (failed) {
+      LOG(ERROR) << "CPU worker " << rank << " failed";
+      exit_code = 1;
+    }
+    if (stopped || failed) {
+      // The other workers cannot go on without it.
+      stopping = true;
+      deadline = 0;
+      kill_cpu_workers(pids);
+    } else if (rank == 0) {
+      // The others are at most one update behind.
+      deadline = time(NULL) + kCPUWorkersExitTimeout;
+    }
+  }
+  boost::interprocess::shared_memory_object::remove(shared_name.c_str());
+  exit(exit_code);
+}
+
 // Train / Finetune a model.
 int train() {
   CHECK_GT(FLAGS_solver.size(), 0) << "Need a solver definition to train.";
@@ -216,9 +325,21 @@ int train() {
     Caffe::set_solver_count(gpus.size());
   }
 
+  ostringstream cpu_workers_name;
+  if (FLAGS_cpu_workers > 1) {
+    CHECK_EQ(gpus.size(), 0) << "CPU workers cannot train on GPUs.";
+    cpu_workers_name << "caffe_cpu_workers_" << getpid();
+    Caffe::set_solver_rank(fork_cpu_workers(cpu_workers_name.str()));
+    Caffe::set_solver_count(FLAGS_cpu_workers);
+    Caffe::set_multiprocess(true);
+  }
+
+  // Only rank 0 acts on signals, so that all solvers stop together.
   caffe::SignalHandler signal_handler(
-        GetRequestedAction(FLAGS_sigint_effect),
-        GetRequestedAction(FLAGS_sighup_effect));
+        Caffe::root_solver() ? GetRequestedAction(FLAGS_sigint_effect) :
+            caffe::SolverAction::NONE,
+        Caffe::root_solver() ? GetRequestedAction(FLAGS_sighup_effect) :
+            caffe::SolverAction::NONE);
 
   if (FLAGS_snapshot.size()) {
     solver_param.clear_weights();
@@ -245,6 +366,24 @@ int train() {
 #else
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif
+  } else if (FLAGS_cpu_workers > 1) {
+    caffe::SharedMemoryAllReduce<float> allreduce(solver,
+        cpu_workers_name.str());
+    solver->add_callback(&allreduce);
+    if (solver->param().layer_wise_reduce()) {
+      solver->net()->add_after_backward(&allreduce);
+    }
+    allreduce.Broadcast();
+    if (Caffe::root_solver()) {
+      solver->Solve();
+      if (solver->iter() < solver->param().max_iter()) {
+        // The other workers wait for the next iteration.
+        return kCPUWorkersStopped;
+      }
+    } else {
+      // Only rank 0 tests and snapshots.
+      solver->Step(solver->param().max_iter() - solver->iter());
+    }
   } else {
     solver->Solve();
   }
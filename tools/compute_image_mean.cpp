@@ -1,11 +1,13 @@
-
 #include <stdint.h>
 #include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
@@ -18,9 +20,70 @@ using namespace caffe;  // NOLINT(build/namespaces)
 using std::max;
 using std::pair;
 using boost::scoped_ptr;
+using boost::shared_ptr;
 
 DEFINE_string(backend, "lmdb",
         "The backend {leveldb, lmdb} containing the images");
+DEFINE_int32(threads, 0,
+    "Number of threads decoding and summing images; 0 for one per core");
+DEFINE_double(sample_fraction, 1,
+    "Fraction of the images to compute an approximate mean from, evenly "
+    "spread over the db");
+DEFINE_string(mean_value_file, "",
+    "Optional: file to write the per-channel means to, as mean_value fields "
+    "of a transform_param");
+
+#ifdef USE_OPENCV
+// A contiguous range of records summed by one thread.
+struct Partition {
+  shared_ptr<db::Cursor> cursor;
+  size_t first_index;
+  size_t size;
+  // Sums of the sampled records, in double precision so that large
+  // datasets do not lose the low bits of the pixels.
+  std::vector<double> sum;
+  int count;
+};
+
+// Whether the index-th record is in the sample. Picks records evenly, the
+// same ones whatever the partitioning.
+static bool Sampled(size_t index, double fraction) {
+  return static_cast<size_t>((index + 1) * fraction) >
+      static_cast<size_t>(index * fraction);
+}
+
+static void SumPartition(Partition* partition, int data_size) {
+  partition->sum.assign(data_size, 0.);
+  partition->count = 0;
+  Datum datum;
+  for (size_t i = 0; i < partition->size; ++i, partition->cursor->Next()) {
+    if (!Sampled(partition->first_index + i, FLAGS_sample_fraction)) {
+      continue;
+    }
+    datum.ParseFromString(partition->cursor->value());
+    DecodeDatumNative(&datum);
+
+    const std::string& data = datum.data();
+    const int size_in_datum = std::max<int>(datum.data().size(),
+        datum.float_data_size());
+    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
+        size_in_datum;
+    double* sum = &partition->sum[0];
+    if (data.size() != 0) {
+      CHECK_EQ(data.size(), size_in_datum);
+      for (int i = 0; i < size_in_datum; ++i) {
+        sum[i] += (uint8_t)data[i];
+      }
+    } else {
+      CHECK_EQ(datum.float_data_size(), size_in_datum);
+      for (int i = 0; i < size_in_datum; ++i) {
+        sum[i] += datum.float_data(i);
+      }
+    }
+    ++partition->count;
+  }
+}
+#endif  // USE_OPENCV
 
 int main(int argc, char** argv) {
 #ifdef USE_OPENCV
@@ -43,13 +106,14 @@ int main(int argc, char** argv) {
     gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/compute_image_mean");
     return 1;
   }
+  CHECK_GT(FLAGS_sample_fraction, 0);
+  CHECK_LE(FLAGS_sample_fraction, 1);
 
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
   db->Open(argv[1], db::READ);
   scoped_ptr<db::Cursor> cursor(db->NewCursor());
 
   BlobProto sum_blob;
-  int count = 0;
   // load first datum
   Datum datum;
   datum.ParseFromString(cursor->value());
@@ -63,46 +127,51 @@ int main(int argc, char** argv) {
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
   const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
-  }
-  LOG(INFO) << "Starting iteration";
-  while (cursor->valid()) {
-    Datum datum;
-    datum.ParseFromString(cursor->value());
-    DecodeDatumNative(&datum);
 
-    const std::string& data = datum.data();
-    size_in_datum = std::max<int>(datum.data().size(),
-        datum.float_data_size());
-    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-        size_in_datum;
-    if (data.size() != 0) {
-      CHECK_EQ(data.size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-      }
-    } else {
-      CHECK_EQ(datum.float_data_size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) +
-            static_cast<float>(datum.float_data(i)));
-      }
-    }
-    ++count;
-    if (count % 10000 == 0) {
-      LOG(INFO) << "Processed " << count << " files.";
+  // Split the db into one contiguous partition per thread, finding where
+  // each starts in a single walk over the keys.
+  const size_t records = cursor->count();
+  const int threads = std::max<int>(1, std::min<size_t>(records,
+      FLAGS_threads > 0 ? FLAGS_threads :
+      boost::thread::hardware_concurrency()));
+  std::vector<Partition> partitions(threads);
+  for (int t = 0; t < threads; ++t) {
+    partitions[t].first_index = records * t / threads;
+    partitions[t].size = records * (t + 1) / threads -
+        partitions[t].first_index;
+  }
+  size_t index = 0;
+  for (int t = 0; t < threads; ++t) {
+    for (; index < partitions[t].first_index; ++index) {
+      cursor->Next();
     }
-    cursor->Next();
+    partitions[t].cursor.reset(db->NewCursor());
+    partitions[t].cursor->Seek(cursor->key());
   }
 
-  if (count % 10000 != 0) {
-    LOG(INFO) << "Processed " << count << " files.";
+  LOG(INFO) << "Starting iteration over " << records << " records with "
+      << threads << " threads";
+  boost::thread_group workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.create_thread(boost::bind(&SumPartition, &partitions[t],
+        data_size));
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  workers.join_all();
+
+  // Merge the partial sums.
+  std::vector<double> sum(data_size, 0.);
+  int count = 0;
+  for (int t = 0; t < threads; ++t) {
+    for (int i = 0; i < data_size; ++i) {
+      sum[i] += partitions[t].sum[i];
+    }
+    count += partitions[t].count;
+  }
+  LOG(INFO) << "Processed " << count << " files.";
+  CHECK_GT(count, 0) << "No images sampled.";
+
+  for (int i = 0; i < data_size; ++i) {
+    sum_blob.add_data(sum[i] / count);
   }
   // Write to disk
   if (argc == 3) {
@@ -111,16 +180,26 @@ int main(int argc, char** argv) {
   }
   const int channels = sum_blob.channels();
   const int dim = sum_blob.height() * sum_blob.width();
-  std::vector<float> mean_values(channels, 0.0);
+  std::vector<double> mean_values(channels, 0.0);
   LOG(INFO) << "Number of channels: " << channels;
   for (int c = 0; c < channels; ++c) {
     for (int i = 0; i < dim; ++i) {
-      mean_values[c] += sum_blob.data(dim * c + i);
+      mean_values[c] += sum[dim * c + i];
+    }
+    mean_values[c] /= static_cast<double>(count) * dim;
+    LOG(INFO) << "mean_value channel [" << c << "]: " << mean_values[c];
+  }
+  if (!FLAGS_mean_value_file.empty()) {
+    LOG(INFO) << "Write mean values to " << FLAGS_mean_value_file;
+    std::ofstream mean_value_file(FLAGS_mean_value_file.c_str());
+    for (int c = 0; c < channels; ++c) {
+      mean_value_file << "mean_value: " << mean_values[c] << std::endl;
     }
-    LOG(INFO) << "mean_value channel [" << c << "]: " << mean_values[c] / dim;
+    CHECK(mean_value_file.good()) << "Cannot write "
+        << FLAGS_mean_value_file;
   }
 #else
   LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
 #endif  // USE_OPENCV
   return 0;
-}
\ No newline at end of file
+}
@@ -8,18 +8,28 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+//
+// Images are read, resized and encoded by a pool of threads, and written in
+// the order of LISTFILE by the main thread. With --resume, the images whose
+// keys are already in DB_NAME are skipped, so that an interrupted conversion
+// can be continued.
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/filesystem.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
@@ -43,6 +53,123 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_int32(threads, 0,
+    "Number of threads reading and resizing images; 0 for one per core");
+DEFINE_int32(commit_mb, 64,
+    "Commit to the db whenever this many megabytes have been put");
+DEFINE_bool(resume, false,
+    "Add to an existing db, skipping the images it already holds");
+DEFINE_int32(shuffle_seed, -1,
+    "Optional: seed for --shuffle, to shuffle the same way on --resume");
+
+#ifdef USE_OPENCV
+// Images in flight between the readers and the writer. The readers stay at
+// most this many images ahead of the writer, which bounds the memory used.
+const int kWindow = 1024;
+
+// An image converted by a reader, waiting in its window slot to be written.
+struct Converted {
+  Converted() : ready(false), status(false) {}
+  bool ready;
+  bool status;
+  string key;
+  string value;
+  int pixel_count;
+  int data_size;
+};
+
+class Converter {
+ public:
+  Converter(const string& root_folder,
+      const std::vector<std::pair<std::string, int> >& lines,
+      const std::set<string>& existing)
+      : root_folder_(root_folder), lines_(lines), existing_(existing),
+        slots_(kWindow), next_(0), written_(0) {}
+
+  // Reader thread: converts the next image not yet taken by another reader.
+  void Read() {
+    const bool is_color = !FLAGS_gray;
+    const int resize_height = std::max<int>(0, FLAGS_resize_height);
+    const int resize_width = std::max<int>(0, FLAGS_resize_width);
+    Datum datum;
+    for (;;) {
+      int line_id;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (next_ < lines_.size() && next_ >= written_ + kWindow) {
+          written_changed_.wait(lock);
+        }
+        if (next_ == lines_.size()) {
+          return;
+        }
+        line_id = next_++;
+      }
+      const string& filename = lines_[line_id].first;
+      Converted converted;
+      converted.key = caffe::format_int(line_id, 8) + "_" + filename;
+      if (existing_.count(filename) == 0) {
+        std::string enc = FLAGS_encode_type;
+        if (FLAGS_encoded && !enc.size()) {
+          // Guess the encoding type from the file name
+          size_t p = filename.rfind('.');
+          if ( p == filename.npos )
+            LOG(WARNING) << "Failed to guess the encoding of '" << filename
+                << "'";
+          enc = filename.substr(p+1);
+          std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+        }
+        converted.status = ReadImageToDatum(root_folder_ + filename,
+            lines_[line_id].second, resize_height, resize_width, is_color,
+            enc, &datum);
+        if (converted.status) {
+          converted.pixel_count =
+              datum.channels() * datum.height() * datum.width();
+          converted.data_size = datum.data().size();
+          CHECK(datum.SerializeToString(&converted.value));
+        }
+      }
+      boost::mutex::scoped_lock lock(mutex_);
+      Converted& slot = slots_[line_id % kWindow];
+      slot.status = converted.status;
+      slot.pixel_count = converted.pixel_count;
+      slot.data_size = converted.data_size;
+      slot.key.swap(converted.key);
+      slot.value.swap(converted.value);
+      slot.ready = true;
+      slot_ready_.notify_all();
+    }
+  }
+
+  // Writer: waits for the next image in list order.
+  void Next(Converted* converted) {
+    boost::mutex::scoped_lock lock(mutex_);
+    Converted& slot = slots_[written_ % kWindow];
+    while (!slot.ready) {
+      slot_ready_.wait(lock);
+    }
+    converted->status = slot.status;
+    converted->pixel_count = slot.pixel_count;
+    converted->data_size = slot.data_size;
+    converted->key.swap(slot.key);
+    converted->value.swap(slot.value);
+    slot.ready = false;
+    ++written_;
+    written_changed_.notify_all();
+  }
+
+ protected:
+  const string root_folder_;
+  const std::vector<std::pair<std::string, int> >& lines_;
+  // File names of the images already in the db.
+  const std::set<string>& existing_;
+  std::vector<Converted> slots_;
+  size_t next_;
+  size_t written_;
+  boost::mutex mutex_;
+  boost::condition_variable slot_ready_;
+  boost::condition_variable written_changed_;
+};
+#endif  // USE_OPENCV
 
 int main(int argc, char** argv) {
 #ifdef USE_OPENCV
@@ -67,7 +194,6 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  const bool is_color = !FLAGS_gray;
   const bool check_size = FLAGS_check_size;
   const bool encoded = FLAGS_encoded;
   const string encode_type = FLAGS_encode_type;
@@ -85,6 +211,9 @@ int main(int argc, char** argv) {
   if (FLAGS_shuffle) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
+    if (FLAGS_shuffle_seed >= 0) {
+      Caffe::set_random_seed(FLAGS_shuffle_seed);
+    }
     shuffle(lines.begin(), lines.end());
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
@@ -92,66 +221,87 @@ int main(int argc, char** argv) {
   if (encode_type.size() && !encoded)
     LOG(INFO) << "encode_type specified, assuming encoded=true.";
 
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
-
-  // Create new DB
+  // Create new DB, or open the one to resume
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
-  db->Open(argv[3], db::NEW);
+  const bool resume = FLAGS_resume && boost::filesystem::exists(argv[3]);
+  db->Open(argv[3], resume ? db::WRITE : db::NEW);
+
+  // Keys are the line number followed by the file name. As the line number
+  // changes when shuffling anew, images are recognized by file name alone.
+  std::set<string> existing;
+  if (resume) {
+    scoped_ptr<db::Cursor> cursor(db->NewCursor());
+    for (; cursor->valid(); cursor->Next()) {
+      const string key = cursor->key();
+      existing.insert(key.substr(key.find('_') + 1));
+    }
+    LOG(INFO) << "Resuming with " << existing.size() << " images in the db.";
+  }
   scoped_ptr<db::Transaction> txn(db->NewTransaction());
 
-  // Storing to db
+  // Read and convert images in parallel
   std::string root_folder(argv[1]);
-  Datum datum;
+  Converter converter(root_folder, lines, existing);
+  const int threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
+  boost::thread_group readers;
+  for (int i = 0; i < threads; ++i) {
+    readers.create_thread(boost::bind(&Converter::Read, &converter));
+  }
+  LOG(INFO) << "Converting with " << threads << " threads.";
+
+  // Storing to db
+  const size_t commit_bytes = static_cast<size_t>(FLAGS_commit_mb) << 20;
+  Converted converted;
   int count = 0;
+  int skipped = 0;
+  size_t pending_bytes = 0;
   int data_size = 0;
   bool data_size_initialized = false;
+  caffe::CPUTimer timer;
+  timer.Start();
 
   for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p+1);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+    converter.Next(&converted);
+    if (existing.count(lines[line_id].first)) {
+      ++skipped;
+      continue;
     }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
-    if (status == false) continue;
+    if (converted.status == false) continue;
     if (check_size) {
       if (!data_size_initialized) {
-        data_size = datum.channels() * datum.height() * datum.width();
+        data_size = converted.pixel_count;
         data_size_initialized = true;
       } else {
-        const std::string& data = datum.data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+        CHECK_EQ(converted.data_size, data_size) << "Incorrect data field size "
+            << converted.data_size;
       }
     }
-    // sequential
-    string key_str = caffe::format_int(line_id, 8) + "_" + lines[line_id].first;
 
     // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
-    txn->Put(key_str, out);
+    txn->Put(converted.key, converted.value);
+    ++count;
 
-    if (++count % 1000 == 0) {
+    // Commit by size rather than by count, so that transactions of large
+    // images do not grow too big and those of small ones not too small.
+    pending_bytes += converted.key.size() + converted.value.size();
+    if (pending_bytes >= commit_bytes) {
       // Commit db
       txn->Commit();
       txn.reset(db->NewTransaction());
-      LOG(INFO) << "Processed " << count << " files.";
+      pending_bytes = 0;
+      LOG(INFO) << "Processed " << count << " files, "
+          << count / timer.Seconds() << " files/s.";
     }
   }
+  readers.join_all();
   // write the last batch
-  if (count % 1000 != 0) {
+  if (pending_bytes > 0) {
     txn->Commit();
-    LOG(INFO) << "Processed " << count << " files.";
+  }
+  LOG(INFO) << "Processed " << count << " files.";
+  if (skipped > 0) {
+    LOG(INFO) << "Skipped " << skipped << " files already in the db.";
   }
 #else
   LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
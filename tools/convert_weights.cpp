@@ -0,0 +1,35 @@
+// This program converts a caffemodel to a weights file, which nets load by
+// mapping it rather than parsing it; see caffe/util/weights_file.hpp.
+// Usage:
+//    convert_weights net.caffemodel net.caffeweights
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weights_file.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_weights caffemodel_in weights_file_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromBinaryFileOrDie(argv[1], &net_param);
+  if (net_param.has_base_weights()) {
+    LOG(ERROR) << argv[1] << " is a delta snapshot of "
+        << net_param.base_weights() << "; convert a full snapshot instead.";
+    return 2;
+  }
+  WriteWeightsFile(net_param, argv[2]);
+
+  LOG(INFO) << "Wrote weights file to " << argv[2];
+  return 0;
+}